@@ -1,3 +1,8 @@
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
 #ifndef __PROGTEST__
 #include <cstdio>
 #include <cstdlib>
@@ -6,12 +11,17 @@
 #include <sstream>
 
 #include <algorithm>
+#include <chrono>
 #include <deque>
+#include <functional>
 #include <list>
 #include <map>
 #include <queue>
+#include <random>
+#include <regex>
 #include <set>
 #include <stack>
+#include <tuple>
 #include <vector>
 
 #include <cassert>
@@ -44,84 +54,677 @@ struct DFA {
 #endif
 
 
-DFA determinize(const MISNFA& nfa){
-    DFA dfa;
-    std::map<std::set<State>, State> graph;
-    std::queue<std::set<State>> q;
-
-    graph[nfa.m_InitialStates] = 0;
-    q.push(nfa.m_InitialStates);
-
-    dfa.m_InitialState = 0;
-    dfa.m_Alphabet = nfa.m_Alphabet;
-
-    while (!q.empty()){
-        auto c = q.front();
-        q.pop();
-
-        for (const auto& symbol : nfa.m_Alphabet){
-            std::set<State> new_state;
-
-            for (const auto& state : c) //if there are transition from this state and symbol then add to which states
-                if (nfa.m_Transitions.count({state, symbol}) > 0)
-                    new_state.insert(nfa.m_Transitions.at({state, symbol}).begin(), nfa.m_Transitions.at({state, symbol}).end());
-
-            if (!new_state.empty()){
-                if (graph.count(new_state) == 0){ //add new state to graph
-                    int currentSize = graph.size();
-                    graph[new_state] = currentSize;
-                    dfa.m_States.insert(currentSize);
-                    q.push(new_state);
-                }
-                dfa.m_Transitions[{graph[c], symbol}] = graph[new_state]; //add transition
+// DFA in contiguous arrays: one row of m_Alphabet.size() targets per state (NO_STATE where the transition is missing)
+// and a bitset of final states, states are numbered 0 .. stateCount() - 1 without gaps.
+struct FlatDFA {
+    static constexpr State NO_STATE = ~State(0);
+
+    size_t stateCount() const {
+        return m_StateCount;
+    }
+
+    bool isFinal(State state) const {
+        return (m_Final[state / 64] >> (state % 64)) & 1;
+    }
+
+    State next(State state, Symbol symbol) const {
+        int column = m_Column[static_cast<unsigned char>(symbol)];
+        return column < 0 ? NO_STATE : m_Next[state * m_Alphabet.size() + column];
+    }
+
+    bool accepts(const std::string& word) const {
+        State state = m_InitialState;
+        for (char symbol : word)
+            if ((state = next(state, symbol)) == NO_STATE)
+                return false;
+        return isFinal(state);
+    }
+
+    DFA toDFA() const {
+        DFA dfa;
+        dfa.m_Alphabet.insert(m_Alphabet.begin(), m_Alphabet.end());
+        dfa.m_InitialState = m_InitialState;
+        for (State state = 0; state < stateCount(); ++state){
+            dfa.m_States.insert(state);
+            if (isFinal(state))
+                dfa.m_FinalStates.insert(state);
+            for (size_t column = 0; column < m_Alphabet.size(); ++column)
+                if (m_Next[state * m_Alphabet.size() + column] != NO_STATE)
+                    dfa.m_Transitions.emplace_hint(dfa.m_Transitions.end(), std::make_pair(state, m_Alphabet[column]), m_Next[state * m_Alphabet.size() + column]);
+        }
+        return dfa;
+    }
+
+    std::vector<Symbol> m_Alphabet; //sorted
+    std::array<int, 256> m_Column; //column of each symbol in the rows, -1 outside of the alphabet
+    std::vector<State> m_Next;
+    std::vector<uint64_t> m_Final;
+    State m_InitialState = 0;
+    size_t m_StateCount = 0;
+};
+
+// Subset construction straight into FlatDFA rows, followed by removal of states which cannot reach a final state.
+// Useful states keep the order in which they were discovered and get compact numbers.
+FlatDFA determinizeFlat(const MISNFA& nfa){
+    FlatDFA flat;
+    flat.m_Alphabet.assign(nfa.m_Alphabet.begin(), nfa.m_Alphabet.end());
+    flat.m_Column.fill(-1);
+    for (size_t column = 0; column < flat.m_Alphabet.size(); ++column)
+        flat.m_Column[static_cast<unsigned char>(flat.m_Alphabet[column])] = column;
+    size_t columns = flat.m_Alphabet.size();
+
+    std::map<State, size_t> index; //nfa states -> 0 .. n - 1
+    for (State state : nfa.m_States)
+        index.emplace(state, index.size());
+    std::vector<std::vector<size_t>> targets(index.size() * columns);
+    for (const auto& [from, to] : nfa.m_Transitions)
+        for (State state : to)
+            targets[index.at(from.first) * columns + flat.m_Column[static_cast<unsigned char>(from.second)]].push_back(index.at(state));
+    std::vector<bool> nfaFinal(index.size(), false);
+    for (State state : nfa.m_FinalStates)
+        nfaFinal[index.at(state)] = true;
+
+    std::map<std::vector<size_t>, State> subsetIds;
+    std::vector<std::vector<size_t>> subsets;
+    std::vector<State> next; //rows of all discovered subsets
+    std::vector<bool> final;
+    std::vector<size_t> stamp(index.size(), SIZE_MAX);
+    std::vector<size_t> initial;
+    for (State state : nfa.m_InitialStates)
+        initial.push_back(index.at(state));
+    subsetIds.emplace(initial, 0);
+    subsets.push_back(initial);
+
+    for (size_t current = 0; current < subsets.size(); ++current){ //subsets are discovered in BFS order, so the list is the queue
+        final.push_back(std::any_of(subsets[current].begin(), subsets[current].end(), [&](size_t state){ return nfaFinal[state]; }));
+        for (size_t column = 0; column < columns; ++column){
+            std::vector<size_t> target;
+            size_t mark = current * columns + column;
+            for (size_t state : subsets[current])
+                for (size_t to : targets[state * columns + column])
+                    if (stamp[to] != mark){
+                        stamp[to] = mark;
+                        target.push_back(to);
+                    }
+            if (target.empty()){
+                next.push_back(FlatDFA::NO_STATE);
+                continue;
             }
+            std::sort(target.begin(), target.end());
+            auto [it, inserted] = subsetIds.emplace(target, subsets.size());
+            if (inserted)
+                subsets.push_back(std::move(target));
+            next.push_back(it->second);
+        }
+    }
 
-            for (const auto& state : c)
-                if (nfa.m_FinalStates.count(state) > 0){ //if final in nfa then in dfa as well
-                    dfa.m_FinalStates.insert(graph[c]);
-                    break;
-                }
+    std::vector<std::vector<State>> reverse(subsets.size()); //backward search from the final states for useful states
+    for (size_t i = 0; i < next.size(); ++i)
+        if (next[i] != FlatDFA::NO_STATE)
+            reverse[next[i]].push_back(i / columns);
+    std::vector<bool> useful(subsets.size(), false);
+    std::vector<State> stack;
+    for (State state = 0; state < subsets.size(); ++state)
+        if (final[state]){
+            useful[state] = true;
+            stack.push_back(state);
         }
+    while (!stack.empty()){
+        State state = stack.back();
+        stack.pop_back();
+        for (State from : reverse[state])
+            if (!useful[from]){
+                useful[from] = true;
+                stack.push_back(from);
+            }
     }
 
-    std::set<State> usefulStates;
-    for (const auto& fs : dfa.m_FinalStates){ //removing useless states from which we dont have transitions to the final states
-        std::stack<State> s;
-        s.push(fs);
+    if (!useful[0]){ //empty language, one state with loops over the whole alphabet
+        flat.m_Next.assign(columns, 0);
+        flat.m_Final.assign(1, 0);
+        flat.m_StateCount = 1;
+        return flat;
+    }
+
+    std::vector<State> renumbered(subsets.size(), FlatDFA::NO_STATE);
+    for (State state = 0; state < subsets.size(); ++state)
+        if (useful[state])
+            renumbered[state] = flat.m_StateCount++;
+    flat.m_Next.reserve(flat.m_StateCount * columns);
+    flat.m_Final.assign((flat.m_StateCount + 63) / 64, 0);
+    for (State state = 0; state < subsets.size(); ++state){
+        if (!useful[state])
+            continue;
+        for (size_t column = 0; column < columns; ++column){
+            State target = next[state * columns + column];
+            flat.m_Next.push_back(target == FlatDFA::NO_STATE ? FlatDFA::NO_STATE : renumbered[target]);
+        }
+        if (final[state])
+            flat.m_Final[renumbered[state] / 64] |= uint64_t(1) << (renumbered[state] % 64);
+    }
+    return flat;
+}
+
+DFA determinize(const MISNFA& nfa){
+    return determinizeFlat(nfa).toDFA();
+}
+
+// Result of reduceNFA(): the reduced automaton (states 0 .. n - 1) and what each step removed.
+struct NFAReduction {
+    MISNFA m_NFA;
+    size_t m_StatesBefore = 0;
+    size_t m_StatesAfter = 0;
+    size_t m_TransitionsBefore = 0;
+    size_t m_TransitionsAfter = 0;
+    size_t m_UselessStates = 0; //unreachable or unable to reach a final state
+    size_t m_ForwardMerged = 0; //states merged into a forward bisimilar state
+    size_t m_BackwardMerged = 0;
+    size_t m_SimulationMerged = 0; //states merged into a simulation equivalent state
+    size_t m_PrunedTransitions = 0; //transitions and initial states dominated by a simulating sibling
+    bool m_SimulationSkipped = false; //more states than the simulation limit
+};
+
+// NFA with dense states and symbol columns used by reduceNFA(), next[state * columns + column] are sorted targets.
+struct NFAGraph {
+    size_t m_States = 0;
+    size_t m_Columns = 0;
+    std::vector<std::vector<size_t>> m_Next;
+    std::vector<bool> m_Initial;
+    std::vector<bool> m_Final;
 
-        while (!s.empty()){
-            auto c = s.top();
-            s.pop();
+    size_t transitionCount() const {
+        size_t count = 0;
+        for (const auto& targets : m_Next)
+            count += targets.size();
+        return count;
+    }
 
-            if (usefulStates.count(c) > 0)
+    NFAGraph reversed() const {
+        NFAGraph result{m_States, m_Columns, std::vector<std::vector<size_t>>(m_Next.size()), m_Final, m_Initial};
+        for (size_t state = 0; state < m_States; ++state)
+            for (size_t column = 0; column < m_Columns; ++column)
+                for (size_t target : m_Next[state * m_Columns + column])
+                    result.m_Next[target * m_Columns + column].push_back(state);
+        return result;
+    }
+
+    // Every state goes to the state block[state] of the result, where transitions and flags of its members are united.
+    NFAGraph quotient(const std::vector<size_t>& block, size_t blocks) const {
+        NFAGraph result{blocks, m_Columns, std::vector<std::vector<size_t>>(blocks * m_Columns), std::vector<bool>(blocks, false), std::vector<bool>(blocks, false)};
+        for (size_t state = 0; state < m_States; ++state){
+            if (m_Initial[state])
+                result.m_Initial[block[state]] = true;
+            if (m_Final[state])
+                result.m_Final[block[state]] = true;
+            for (size_t column = 0; column < m_Columns; ++column)
+                for (size_t target : m_Next[state * m_Columns + column])
+                    result.m_Next[block[state] * m_Columns + column].push_back(block[target]);
+        }
+        for (auto& targets : result.m_Next){
+            std::sort(targets.begin(), targets.end());
+            targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+        }
+        return result;
+    }
+};
+
+// Keeps only states which are reachable from an initial state and can reach a final state.
+NFAGraph trimNFA(const NFAGraph& graph){
+    auto search = [](const NFAGraph& g, const std::vector<bool>& start){
+        std::vector<bool> found = start;
+        std::vector<size_t> stack;
+        for (size_t state = 0; state < g.m_States; ++state)
+            if (start[state])
+                stack.push_back(state);
+        while (!stack.empty()){
+            size_t state = stack.back();
+            stack.pop_back();
+            for (size_t column = 0; column < g.m_Columns; ++column)
+                for (size_t target : g.m_Next[state * g.m_Columns + column])
+                    if (!found[target]){
+                        found[target] = true;
+                        stack.push_back(target);
+                    }
+        }
+        return found;
+    };
+    std::vector<bool> reachable = search(graph, graph.m_Initial);
+    std::vector<bool> productive = search(graph.reversed(), graph.m_Final);
+
+    std::vector<size_t> block(graph.m_States);
+    size_t kept = 0;
+    for (size_t state = 0; state < graph.m_States; ++state)
+        block[state] = reachable[state] && productive[state] ? kept++ : SIZE_MAX;
+    NFAGraph result{kept, graph.m_Columns, std::vector<std::vector<size_t>>(kept * graph.m_Columns), std::vector<bool>(kept), std::vector<bool>(kept)};
+    for (size_t state = 0; state < graph.m_States; ++state){
+        if (block[state] == SIZE_MAX)
+            continue;
+        result.m_Initial[block[state]] = graph.m_Initial[state];
+        result.m_Final[block[state]] = graph.m_Final[state];
+        for (size_t column = 0; column < graph.m_Columns; ++column)
+            for (size_t target : graph.m_Next[state * graph.m_Columns + column])
+                if (block[target] != SIZE_MAX)
+                    result.m_Next[block[state] * graph.m_Columns + column].push_back(block[target]);
+    }
+    return result;
+}
+
+// Coarsest forward bisimulation by signature refinement: states start split by finality and in every round a state's
+// signature is its block with the (symbol, block) pairs of its successors, until the number of blocks stops growing.
+// Called on the reversed automaton it gives the backward bisimulation. Returns the number of blocks.
+size_t bisimulationBlocks(const NFAGraph& graph, std::vector<size_t>& block){
+    block.assign(graph.m_States, 0);
+    for (size_t state = 0; state < graph.m_States; ++state)
+        block[state] = graph.m_Final[state];
+    size_t blocks = 0;
+    while (true){
+        std::map<std::vector<size_t>, size_t> ids;
+        std::vector<size_t> refined(graph.m_States);
+        for (size_t state = 0; state < graph.m_States; ++state){
+            std::vector<size_t> signature{block[state]};
+            for (size_t column = 0; column < graph.m_Columns; ++column){
+                size_t begin = signature.size();
+                for (size_t target : graph.m_Next[state * graph.m_Columns + column])
+                    signature.push_back(column * graph.m_States + block[target]);
+                std::sort(signature.begin() + begin, signature.end());
+                signature.erase(std::unique(signature.begin() + begin, signature.end()), signature.end());
+            }
+            refined[state] = ids.emplace(std::move(signature), ids.size()).first->second;
+        }
+        block = std::move(refined);
+        if (ids.size() == blocks)
+            return blocks;
+        blocks = ids.size();
+    }
+}
+
+// Maximal direct forward simulation as bitset rows, p is in row q (p simulates q) when p is final if q is final and
+// every transition q -a-> q' is matched by some p -a-> p' with p' simulating q'. Rows only shrink until a fixpoint.
+std::vector<std::vector<uint64_t>> forwardSimulation(const NFAGraph& graph){
+    size_t n = graph.m_States, words = (n + 63) / 64;
+    std::vector<std::vector<uint64_t>> simulatedBy(n, std::vector<uint64_t>(words, 0));
+    for (size_t q = 0; q < n; ++q)
+        for (size_t p = 0; p < n; ++p)
+            if (!graph.m_Final[q] || graph.m_Final[p])
+                simulatedBy[q][p / 64] |= uint64_t(1) << (p % 64);
+
+    NFAGraph reversed = graph.reversed();
+    std::vector<uint64_t> matching(words);
+    for (bool changed = true; changed;){
+        changed = false;
+        for (size_t column = 0; column < graph.m_Columns; ++column)
+            for (size_t target = 0; target < n; ++target){
+                const auto& sources = reversed.m_Next[target * graph.m_Columns + column];
+                if (sources.empty())
+                    continue;
+                std::fill(matching.begin(), matching.end(), 0); //states with an a-successor which simulates target
+                for (size_t next = 0; next < n; ++next)
+                    if ((simulatedBy[target][next / 64] >> (next % 64)) & 1)
+                        for (size_t p : reversed.m_Next[next * graph.m_Columns + column])
+                            matching[p / 64] |= uint64_t(1) << (p % 64);
+                for (size_t q : sources) //every q -a-> target has to be matched
+                    for (size_t word = 0; word < words; ++word){
+                        uint64_t narrowed = simulatedBy[q][word] & matching[word];
+                        changed = changed || narrowed != simulatedBy[q][word];
+                        simulatedBy[q][word] = narrowed;
+                    }
+            }
+    }
+    return simulatedBy;
+}
+
+// Language preserving reduction of an NFA before determinization:
+//  1. useless states are removed,
+//  2. forward and backward bisimilar states are merged, alternately until neither merges anything,
+//  3. simulation equivalent states are merged and every transition (and initial state) whose target is strictly simulated
+//     by the target of a sibling transition over the same symbol is pruned, which keeps the language since the maximal
+//     sibling always survives; this step is quadratic in the number of states and skipped above simulationLimit,
+//  4. states left useless by the pruning are removed again.
+NFAReduction reduceNFA(const MISNFA& nfa, size_t simulationLimit = 2048){
+    NFAReduction report;
+    std::vector<Symbol> alphabet(nfa.m_Alphabet.begin(), nfa.m_Alphabet.end());
+    std::map<State, size_t> index;
+    for (State state : nfa.m_States)
+        index.emplace(state, index.size());
+
+    NFAGraph graph{index.size(), alphabet.size(), std::vector<std::vector<size_t>>(index.size() * alphabet.size()), std::vector<bool>(index.size()), std::vector<bool>(index.size())};
+    for (const auto& [from, to] : nfa.m_Transitions){
+        size_t column = std::lower_bound(alphabet.begin(), alphabet.end(), from.second) - alphabet.begin();
+        for (State state : to)
+            graph.m_Next[index.at(from.first) * graph.m_Columns + column].push_back(index.at(state));
+    }
+    for (State state : nfa.m_InitialStates)
+        graph.m_Initial[index.at(state)] = true;
+    for (State state : nfa.m_FinalStates)
+        graph.m_Final[index.at(state)] = true;
+    report.m_StatesBefore = graph.m_States;
+    report.m_TransitionsBefore = graph.transitionCount();
+
+    graph = trimNFA(graph);
+    report.m_UselessStates = report.m_StatesBefore - graph.m_States;
+
+    std::vector<size_t> block;
+    for (bool merged = true; merged;){
+        merged = false;
+        for (bool backward : {false, true}){
+            size_t blocks = bisimulationBlocks(backward ? graph.reversed() : graph, block);
+            if (blocks == graph.m_States)
                 continue;
+            (backward ? report.m_BackwardMerged : report.m_ForwardMerged) += graph.m_States - blocks;
+            graph = graph.quotient(block, blocks);
+            merged = true;
+        }
+    }
+
+    if (graph.m_States > simulationLimit)
+        report.m_SimulationSkipped = true;
+    else if (graph.m_States > 0){
+        auto simulatedBy = forwardSimulation(graph);
+        auto simulates = [&](size_t p, size_t q){ return (simulatedBy[q][p / 64] >> (p % 64)) & 1; };
 
-            usefulStates.insert(c);
-            for (const auto& trans : dfa.m_Transitions)
-                if (trans.second == c)
-                    s.push(trans.first.first);
+        size_t blocks = 0;
+        block.assign(graph.m_States, SIZE_MAX);
+        for (size_t q = 0; q < graph.m_States; ++q)
+            if (block[q] == SIZE_MAX){
+                block[q] = blocks;
+                for (size_t p = q + 1; p < graph.m_States; ++p)
+                    if (block[p] == SIZE_MAX && simulates(p, q) && simulates(q, p))
+                        block[p] = blocks;
+                ++blocks;
+            }
+        if (blocks < graph.m_States){
+            report.m_SimulationMerged = graph.m_States - blocks;
+            std::vector<std::vector<uint64_t>> quotientSimulation(blocks, std::vector<uint64_t>((blocks + 63) / 64, 0));
+            for (size_t q = 0; q < graph.m_States; ++q)
+                for (size_t p = 0; p < graph.m_States; ++p)
+                    if (simulates(p, q))
+                        quotientSimulation[block[q]][block[p] / 64] |= uint64_t(1) << (block[p] % 64);
+            graph = graph.quotient(block, blocks);
+            simulatedBy = std::move(quotientSimulation);
         }
+
+        auto dominated = [&](size_t q, const std::vector<size_t>& siblings){ //some sibling strictly simulates q
+            return std::any_of(siblings.begin(), siblings.end(), [&](size_t p){ return p != q && simulates(p, q); });
+        };
+        std::vector<size_t> initial;
+        for (size_t state = 0; state < graph.m_States; ++state)
+            if (graph.m_Initial[state])
+                initial.push_back(state);
+        for (size_t state : initial)
+            if (dominated(state, initial)){
+                graph.m_Initial[state] = false;
+                ++report.m_PrunedTransitions;
+            }
+        for (auto& targets : graph.m_Next){
+            std::vector<size_t> kept;
+            for (size_t target : targets)
+                if (!dominated(target, targets))
+                    kept.push_back(target);
+            report.m_PrunedTransitions += targets.size() - kept.size();
+            targets = std::move(kept);
+        }
+        size_t before = graph.m_States;
+        graph = trimNFA(graph);
+        report.m_UselessStates += before - graph.m_States;
     }
-    dfa.m_States = usefulStates;
 
-    if (dfa.m_FinalStates.empty() || dfa.m_States.empty()){ //when dfa accepts only empty language, we need to return one state dfa
-        dfa.m_States.clear();
-        dfa.m_FinalStates.clear();
-        dfa.m_Transitions.clear();
-        dfa.m_States.insert(dfa.m_InitialState);
-        for (const auto& symbol : nfa.m_Alphabet)
-            dfa.m_Transitions[{dfa.m_InitialState, symbol}] = dfa.m_InitialState;
-        return dfa;
+    MISNFA& result = report.m_NFA;
+    result.m_Alphabet = nfa.m_Alphabet;
+    for (size_t state = 0; state < graph.m_States; ++state){
+        result.m_States.insert(state);
+        if (graph.m_Initial[state])
+            result.m_InitialStates.insert(state);
+        if (graph.m_Final[state])
+            result.m_FinalStates.insert(state);
+        for (size_t column = 0; column < graph.m_Columns; ++column)
+            if (!graph.m_Next[state * graph.m_Columns + column].empty())
+                result.m_Transitions[{State(state), alphabet[column]}].insert(graph.m_Next[state * graph.m_Columns + column].begin(), graph.m_Next[state * graph.m_Columns + column].end());
+    }
+    if (result.m_States.empty()){ //empty language, a single initial state keeps the automaton valid
+        result.m_States.insert(0);
+        result.m_InitialStates.insert(0);
+    }
+    report.m_StatesAfter = graph.m_States;
+    report.m_TransitionsAfter = graph.transitionCount();
+    return report;
+}
+
+// Regular expression -> epsilon-free MISNFA by the Glushkov (position) construction.
+// Every occurrence of a symbol or a class in the pattern is a position and a state, reading the position's
+// symbol moves to any position which may follow it, or to the extra final state when the position may be last.
+// The initial states are the positions which may be first (plus the final state for a nullable pattern).
+// Syntax: concatenation, a|b, a*, a+, a?, (a), [abx-z] and \x for a literal x, empty alternatives like (a|) are allowed.
+class RegexCompiler {
+public:
+    RegexCompiler(const std::string& pattern)
+        : m_Pattern(pattern) {}
+
+    MISNFA compile(const std::set<Symbol>& alphabet){
+        m_Position = 0;
+        m_Labels.clear();
+        m_Follow.clear();
+        Part whole = alternation();
+        if (m_Position != m_Pattern.size())
+            error("unexpected ')'");
+
+        MISNFA nfa;
+        State final = m_Labels.size();
+        nfa.m_Alphabet = alphabet;
+        for (State state = 0; state <= final; ++state)
+            nfa.m_States.insert(state);
+        for (State state = 0; state < final; ++state){
+            nfa.m_Alphabet.insert(m_Labels[state].begin(), m_Labels[state].end());
+            for (Symbol symbol : m_Labels[state]){
+                auto& targets = nfa.m_Transitions[{state, symbol}];
+                targets = m_Follow[state];
+                if (whole.m_Last.count(state) > 0)
+                    targets.insert(final);
+            }
+        }
+        nfa.m_InitialStates = whole.m_First;
+        if (whole.m_Nullable)
+            nfa.m_InitialStates.insert(final);
+        nfa.m_FinalStates.insert(final);
+        return nfa;
+    }
+
+private:
+    struct Part {
+        bool m_Nullable = true;
+        std::set<State> m_First;
+        std::set<State> m_Last;
+    };
+
+    [[noreturn]] void error(const std::string& message) const {
+        throw std::invalid_argument("regex '" + m_Pattern + "' at " + std::to_string(m_Position) + ": " + message);
+    }
+
+    bool atEnd() const {
+        return m_Position == m_Pattern.size();
+    }
+
+    Part alternation(){
+        Part result = concatenation();
+        while (!atEnd() && m_Pattern[m_Position] == '|'){
+            ++m_Position;
+            Part next = concatenation();
+            result.m_Nullable = result.m_Nullable || next.m_Nullable;
+            result.m_First.insert(next.m_First.begin(), next.m_First.end());
+            result.m_Last.insert(next.m_Last.begin(), next.m_Last.end());
+        }
+        return result;
+    }
+
+    Part concatenation(){
+        Part result; // empty word
+        while (!atEnd() && m_Pattern[m_Position] != '|' && m_Pattern[m_Position] != ')'){
+            Part next = repetition();
+            for (State state : result.m_Last) //whatever ends the prefix may be followed by whatever starts the next part
+                m_Follow[state].insert(next.m_First.begin(), next.m_First.end());
+            if (result.m_Nullable)
+                result.m_First.insert(next.m_First.begin(), next.m_First.end());
+            if (next.m_Nullable)
+                result.m_Last.insert(next.m_Last.begin(), next.m_Last.end());
+            else
+                result.m_Last = std::move(next.m_Last);
+            result.m_Nullable = result.m_Nullable && next.m_Nullable;
+        }
+        return result;
+    }
+
+    Part repetition(){
+        Part result = atom();
+        while (!atEnd() && (m_Pattern[m_Position] == '*' || m_Pattern[m_Position] == '+' || m_Pattern[m_Position] == '?')){
+            char op = m_Pattern[m_Position++];
+            if (op != '?') //loop back from the last positions to the first ones
+                for (State state : result.m_Last)
+                    m_Follow[state].insert(result.m_First.begin(), result.m_First.end());
+            if (op != '+')
+                result.m_Nullable = true;
+        }
+        return result;
+    }
+
+    Part atom(){
+        if (atEnd())
+            error("missing operand");
+        char c = m_Pattern[m_Position++];
+        if (c == '('){
+            Part inner = alternation();
+            if (atEnd() || m_Pattern[m_Position] != ')')
+                error("missing ')'");
+            ++m_Position;
+            return inner;
+        }
+        if (c == '*' || c == '+' || c == '?')
+            error("missing operand");
+
+        std::set<Symbol> label;
+        if (c == '[')
+            label = characterClass();
+        else
+            label.insert(c == '\\' ? escaped() : c);
+
+        State position = m_Labels.size();
+        m_Labels.push_back(std::move(label));
+        m_Follow.emplace_back();
+        Part result;
+        result.m_Nullable = false;
+        result.m_First = {position};
+        result.m_Last = {position};
+        return result;
+    }
+
+    Symbol escaped(){
+        if (atEnd())
+            error("missing escaped symbol");
+        return m_Pattern[m_Position++];
+    }
+
+    std::set<Symbol> characterClass(){
+        std::set<Symbol> label;
+        while (!atEnd() && m_Pattern[m_Position] != ']'){
+            char from = m_Pattern[m_Position++];
+            if (from == '\\')
+                from = escaped();
+            char to = from;
+            if (m_Position + 1 < m_Pattern.size() && m_Pattern[m_Position] == '-' && m_Pattern[m_Position + 1] != ']'){
+                m_Position++;
+                to = m_Pattern[m_Position++];
+                if (to == '\\')
+                    to = escaped();
+                if (to < from)
+                    error("reversed range");
+            }
+            for (int symbol = from; symbol <= to; ++symbol)
+                label.insert(Symbol(symbol));
+        }
+        if (atEnd())
+            error("missing ']'");
+        ++m_Position;
+        if (label.empty())
+            error("empty class");
+        return label;
+    }
+
+    const std::string m_Pattern;
+    size_t m_Position = 0;
+    std::vector<std::set<Symbol>> m_Labels; //symbols of each position
+    std::vector<std::set<State>> m_Follow; //positions which may follow each position
+};
+
+// The alphabet of the result is the given alphabet extended by the symbols of the pattern.
+MISNFA compileRegex(const std::string& pattern, const std::set<Symbol>& alphabet = {}){
+    return RegexCompiler(pattern).compile(alphabet);
+}
+
+// C++ source of a function `bool functionName(const char* word, size_t length)` which accepts exactly the words of the DFA.
+// Every state is a label and reads one symbol, runs of at least three consecutive symbols with the same target are
+// tested by one range comparison and the remaining symbols by a switch, missing transitions reject the word.
+std::string generateMatcher(const DFA& dfa, const std::string& functionName){
+    std::map<State, std::vector<std::pair<unsigned char, State>>> outgoing; //ordered by symbol value
+    for (const auto& [from, target] : dfa.m_Transitions)
+        outgoing[from.first].push_back({static_cast<unsigned char>(from.second), target});
+
+    std::vector<State> order{dfa.m_InitialState}; //reachable states in BFS order, the initial one falls through
+    std::set<State> seen{dfa.m_InitialState}, targets;
+    for (size_t i = 0; i < order.size(); ++i){
+        auto& transitions = outgoing[order[i]];
+        std::sort(transitions.begin(), transitions.end());
+        for (const auto& [symbol, target] : transitions){
+            targets.insert(target);
+            if (seen.insert(target).second)
+                order.push_back(target);
+        }
     }
 
-    std::map<std::pair<State, Symbol>, State> newTransitions;
-    for (const auto &trans : dfa.m_Transitions) //removing useless transitions (if given transitions leads from one useful state to another)
-        if (usefulStates.count(trans.first.first) > 0 && usefulStates.count(trans.second) > 0)
-            newTransitions[trans.first] = trans.second;
+    auto literal = [](unsigned char symbol){
+        std::string text = std::to_string(symbol);
+        if (symbol >= 32 && symbol < 127 && symbol != '\\')
+            text += std::string(" /* '") + char(symbol) + "' */";
+        return text;
+    };
 
-    dfa.m_Transitions = newTransitions;
+    std::ostringstream out;
+    out << "// Generated by generateMatcher() from a " << order.size() << "-state DFA, do not edit.\n";
+    out << "bool " << functionName << "(const char* word, size_t length){\n";
+    out << "    const char* end = word + length;\n";
+    if (!targets.empty())
+        out << "    unsigned char symbol;\n";
+    for (State state : order){
+        const auto& transitions = outgoing[state];
+        if (targets.count(state) > 0)
+            out << "state" << state << ":\n";
+        out << "    if (word == end)\n";
+        out << "        return " << (dfa.m_FinalStates.count(state) > 0 ? "true" : "false") << ";\n";
+        if (transitions.empty()){
+            out << "    return false;\n";
+            continue;
+        }
+        out << "    symbol = static_cast<unsigned char>(*word++);\n";
 
-    return dfa;
+        std::vector<std::pair<unsigned char, State>> single;
+        for (size_t begin = 0, end; begin < transitions.size(); begin = end){
+            for (end = begin + 1; end < transitions.size() && transitions[end].first == transitions[end - 1].first + 1 && transitions[end].second == transitions[begin].second; ++end)
+                ;
+            if (end - begin < 3){
+                single.insert(single.end(), transitions.begin() + begin, transitions.begin() + end);
+                continue;
+            }
+            out << "    if (static_cast<unsigned char>(symbol - " << literal(transitions[begin].first) << ") <= " << end - begin - 1
+                << ") // up to " << literal(transitions[end - 1].first) << "\n";
+            out << "        goto state" << transitions[begin].second << ";\n";
+        }
+        if (!single.empty()){
+            out << "    switch (symbol){\n";
+            for (const auto& [symbol, target] : single)
+                out << "        case " << literal(symbol) << ": goto state" << target << ";\n";
+            out << "    }\n";
+        }
+        out << "    return false;\n";
+    }
+    out << "}\n";
+    return out.str();
 }
 
 #ifndef __PROGTEST__
@@ -867,8 +1470,428 @@ DFA out13 = {
     {1, 2, 3},
 };
 
-int main()
+// Matchers checked in from generateMatcher(), regenerate them by
+//     ./hw01 --generate '[A-Za-z_][A-Za-z0-9_]*' matchIdentifier
+//     ./hw01 --generate '(h|l|w)*l(h|l|w)(h|l|w)' matchThirdLast
+// Generated by generateMatcher() from a 2-state DFA, do not edit.
+bool matchIdentifier(const char* word, size_t length){
+    const char* end = word + length;
+    unsigned char symbol;
+    if (word == end)
+        return false;
+    symbol = static_cast<unsigned char>(*word++);
+    if (static_cast<unsigned char>(symbol - 65 /* 'A' */) <= 25) // up to 90 /* 'Z' */
+        goto state1;
+    if (static_cast<unsigned char>(symbol - 97 /* 'a' */) <= 25) // up to 122 /* 'z' */
+        goto state1;
+    switch (symbol){
+        case 95 /* '_' */: goto state1;
+    }
+    return false;
+state1:
+    if (word == end)
+        return true;
+    symbol = static_cast<unsigned char>(*word++);
+    if (static_cast<unsigned char>(symbol - 48 /* '0' */) <= 9) // up to 57 /* '9' */
+        goto state1;
+    if (static_cast<unsigned char>(symbol - 65 /* 'A' */) <= 25) // up to 90 /* 'Z' */
+        goto state1;
+    if (static_cast<unsigned char>(symbol - 97 /* 'a' */) <= 25) // up to 122 /* 'z' */
+        goto state1;
+    switch (symbol){
+        case 95 /* '_' */: goto state1;
+    }
+    return false;
+}
+
+// Generated by generateMatcher() from a 8-state DFA, do not edit.
+bool matchThirdLast(const char* word, size_t length){
+    const char* end = word + length;
+    unsigned char symbol;
+state0:
+    if (word == end)
+        return false;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state0;
+        case 108 /* 'l' */: goto state1;
+        case 119 /* 'w' */: goto state0;
+    }
+    return false;
+state1:
+    if (word == end)
+        return false;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state2;
+        case 108 /* 'l' */: goto state3;
+        case 119 /* 'w' */: goto state2;
+    }
+    return false;
+state2:
+    if (word == end)
+        return false;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state4;
+        case 108 /* 'l' */: goto state5;
+        case 119 /* 'w' */: goto state4;
+    }
+    return false;
+state3:
+    if (word == end)
+        return false;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state6;
+        case 108 /* 'l' */: goto state7;
+        case 119 /* 'w' */: goto state6;
+    }
+    return false;
+state4:
+    if (word == end)
+        return true;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state0;
+        case 108 /* 'l' */: goto state1;
+        case 119 /* 'w' */: goto state0;
+    }
+    return false;
+state5:
+    if (word == end)
+        return true;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state2;
+        case 108 /* 'l' */: goto state3;
+        case 119 /* 'w' */: goto state2;
+    }
+    return false;
+state6:
+    if (word == end)
+        return true;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state4;
+        case 108 /* 'l' */: goto state5;
+        case 119 /* 'w' */: goto state4;
+    }
+    return false;
+state7:
+    if (word == end)
+        return true;
+    symbol = static_cast<unsigned char>(*word++);
+    switch (symbol){
+        case 104 /* 'h' */: goto state6;
+        case 108 /* 'l' */: goto state7;
+        case 119 /* 'w' */: goto state6;
+    }
+    return false;
+}
+
+// Table driven matching over a dense row of 256 targets per state, the baseline for the generated matchers.
+struct DenseMatcher {
+    DenseMatcher(const DFA& dfa)
+        : m_Initial(dfa.m_InitialState){
+        State states = dfa.m_States.empty() ? 0 : *dfa.m_States.rbegin() + 1;
+        states = std::max(states, dfa.m_InitialState + 1);
+        m_Next.assign(states * 256, -1);
+        m_Final.assign(states, false);
+        for (const auto& [from, target] : dfa.m_Transitions)
+            m_Next[from.first * 256 + static_cast<unsigned char>(from.second)] = target;
+        for (State state : dfa.m_FinalStates)
+            m_Final[state] = true;
+    }
+
+    bool operator()(const char* word, size_t length) const {
+        int state = m_Initial;
+        for (size_t i = 0; i < length; ++i)
+            if ((state = m_Next[state * 256 + static_cast<unsigned char>(word[i])]) < 0)
+                return false;
+        return m_Final[state];
+    }
+
+    int m_Initial;
+    std::vector<int> m_Next;
+    std::vector<bool> m_Final;
+};
+
+bool dfaAccepts(const DFA& dfa, const std::string& word){
+    State state = dfa.m_InitialState;
+    for (char symbol : word){
+        auto it = dfa.m_Transitions.find({state, symbol});
+        if (it == dfa.m_Transitions.end())
+            return false;
+        state = it->second;
+    }
+    return dfa.m_FinalStates.count(state) > 0;
+}
+
+// Random pattern with about size operands over the given symbols, repeated parts are parenthesized so std::regex accepts it too.
+std::string randomRegex(std::mt19937& random, size_t size, const std::string& symbols){
+    auto symbol = [&](){ return symbols[random() % symbols.size()]; };
+    if (size <= 1){
+        if (random() % 4 > 0)
+            return std::string(1, symbol());
+        char from = symbol(), to = symbol();
+        return std::string("[") + std::min(from, to) + '-' + std::max(from, to) + ']';
+    }
+    size_t left = 1 + random() % (size - 1);
+    switch (random() % 6){
+        case 0:
+            return "(" + randomRegex(random, left, symbols) + "|" + randomRegex(random, size - left, symbols) + ")";
+        case 1:
+            return "(" + randomRegex(random, size - 1, symbols) + ")" + "*+?"[random() % 3];
+        case 2:
+            return "(" + randomRegex(random, size - 1, symbols) + "|)";
+        default:
+            return randomRegex(random, left, symbols) + randomRegex(random, size - left, symbols);
+    }
+}
+
+// Compile and determinization throughput on pattern sets, one JSON object per line on stdout, determinize_s
+// includes the conversion of the flat result into DFA and determinize_flat_s is determinizeFlat() alone,
+// reduce_s is reduceNFA() and reduced_determinize_flat_s is determinizeFlat() of the reduced automata.
+// Options: --patterns 1000 (patterns per set), --size 32 (operands per random pattern), --seed 1.
+int runBenchmarks(int argc, char** argv){
+    size_t patterns = 1000, size = 32;
+    unsigned seed = 1;
+    for (int i = 2; i + 1 < argc; i += 2){
+        std::string option = argv[i], value = argv[i + 1];
+        if (option == "--patterns")
+            patterns = std::stoul(value);
+        else if (option == "--size")
+            size = std::stoul(value);
+        else if (option == "--seed")
+            seed = std::stoul(value);
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::mt19937 random(seed);
+    std::vector<std::pair<std::string, std::vector<std::string>>> sets(3);
+    sets[0].first = "random-binary";
+    sets[1].first = "random-letters";
+    sets[2].first = "dictionary"; //one alternation of many words, a single large pattern
+    for (size_t i = 0; i < patterns; ++i){
+        sets[0].second.push_back(randomRegex(random, size, "ab"));
+        sets[1].second.push_back(randomRegex(random, size, "abcdefghij"));
+    }
+    std::string dictionary;
+    for (size_t i = 0; i < patterns; ++i){
+        dictionary += i ? "|" : "";
+        for (size_t j = 0; j < 8; ++j)
+            dictionary += char('a' + random() % 26);
+    }
+    sets[2].second.push_back(dictionary);
+
+    for (const auto& [name, set] : sets){
+        size_t symbols = 0, states = 0, transitions = 0, dfaStates = 0, flatStates = 0;
+        std::vector<MISNFA> nfas;
+        nfas.reserve(set.size());
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& pattern : set)
+            nfas.push_back(compileRegex(pattern));
+        auto compiled = std::chrono::steady_clock::now();
+        for (const auto& nfa : nfas)
+            dfaStates += determinize(nfa).m_States.size();
+        auto determinized = std::chrono::steady_clock::now();
+        for (const auto& nfa : nfas)
+            flatStates += determinizeFlat(nfa).stateCount();
+        auto flattened = std::chrono::steady_clock::now();
+        assert(flatStates == dfaStates);
+        size_t reducedStates = 0, reducedDfaStates = 0;
+        std::vector<MISNFA> reduced;
+        for (const auto& nfa : nfas){
+            reduced.push_back(reduceNFA(nfa).m_NFA);
+            reducedStates += reduced.back().m_States.size();
+        }
+        auto reducedAt = std::chrono::steady_clock::now();
+        for (const auto& nfa : reduced)
+            reducedDfaStates += determinizeFlat(nfa).stateCount();
+        auto reducedDeterminized = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < set.size(); ++i){
+            symbols += set[i].size();
+            states += nfas[i].m_States.size();
+            for (const auto& transition : nfas[i].m_Transitions)
+                transitions += transition.second.size();
+        }
+        double compileSeconds = std::chrono::duration<double>(compiled - start).count();
+        double determinizeSeconds = std::chrono::duration<double>(determinized - compiled).count();
+        double flatSeconds = std::chrono::duration<double>(flattened - determinized).count();
+        double reduceSeconds = std::chrono::duration<double>(reducedAt - flattened).count();
+        double reducedFlatSeconds = std::chrono::duration<double>(reducedDeterminized - reducedAt).count();
+        std::cout << "{\"set\":\"" << name << "\""
+                  << ",\"patterns\":" << set.size()
+                  << ",\"pattern_symbols\":" << symbols
+                  << ",\"nfa_states\":" << states
+                  << ",\"nfa_transitions\":" << transitions
+                  << ",\"dfa_states\":" << dfaStates
+                  << ",\"compile_s\":" << compileSeconds
+                  << ",\"patterns_per_s\":" << (compileSeconds > 0 ? set.size() / compileSeconds : 0)
+                  << ",\"pattern_symbols_per_s\":" << (compileSeconds > 0 ? symbols / compileSeconds : 0)
+                  << ",\"determinize_s\":" << determinizeSeconds
+                  << ",\"determinize_flat_s\":" << flatSeconds
+                  << ",\"reduced_nfa_states\":" << reducedStates
+                  << ",\"reduced_dfa_states\":" << reducedDfaStates
+                  << ",\"reduce_s\":" << reduceSeconds
+                  << ",\"reduced_determinize_flat_s\":" << reducedFlatSeconds << "}" << std::endl;
+    }
+
+    //matching throughput of the generated matchers against the table driven paths, on random walks of the DFA
+    using Matcher = bool (*)(const char*, size_t);
+    for (const auto& [name, pattern, generated] : {std::make_tuple("identifier", "[A-Za-z_][A-Za-z0-9_]*", Matcher(matchIdentifier)),
+                                                   std::make_tuple("third-last", "(h|l|w)*l(h|l|w)(h|l|w)", Matcher(matchThirdLast))}){
+        DFA dfa = determinize(compileRegex(pattern));
+        DenseMatcher dense(dfa);
+        std::map<State, std::vector<char>> symbolsOf;
+        for (const auto& transition : dfa.m_Transitions)
+            symbolsOf[transition.first.first].push_back(transition.first.second);
+        std::vector<std::string> words(patterns * 100);
+        size_t symbols = 0;
+        for (auto& word : words){
+            State state = dfa.m_InitialState;
+            for (size_t i = 0; i < 64 && !symbolsOf[state].empty(); ++i){
+                word.push_back(symbolsOf[state][random() % symbolsOf[state].size()]);
+                state = dfa.m_Transitions.at({state, word.back()});
+            }
+            symbols += word.size();
+        }
+
+        std::vector<std::pair<std::string, std::function<bool(const std::string&)>>> matchers{
+            {"generated", [&, generated = generated](const std::string& word){ return generated(word.data(), word.size()); }},
+            {"dense-table", [&](const std::string& word){ return dense(word.data(), word.size()); }},
+            {"map", [&](const std::string& word){ return dfaAccepts(dfa, word); }},
+        };
+        for (const auto& [matcher, match] : matchers){
+            size_t accepted = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& word : words)
+                accepted += match(word);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "{\"matcher\":\"" << matcher << "\""
+                      << ",\"dfa\":\"" << name << "\""
+                      << ",\"dfa_states\":" << dfa.m_States.size()
+                      << ",\"words\":" << words.size()
+                      << ",\"accepted\":" << accepted
+                      << ",\"match_s\":" << seconds
+                      << ",\"symbols_per_s\":" << (seconds > 0 ? symbols / seconds : 0) << "}" << std::endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
 {
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+        return runBenchmarks(argc, argv);
+    if (argc == 4 && std::string(argv[1]) == "--generate"){ //--generate <regex> <function name>
+        std::cout << generateMatcher(determinize(compileRegex(argv[2])), argv[3]);
+        return 0;
+    }
+
+    MISNFA star = compileRegex("ab*");
+    assert(star.m_States == std::set<State>({0, 1, 2}));
+    assert(star.m_Alphabet == std::set<Symbol>({'a', 'b'}));
+    assert((star.m_Transitions == std::map<std::pair<State, Symbol>, std::set<State>>{{{0, 'a'}, {1, 2}}, {{1, 'b'}, {1, 2}}}));
+    assert(star.m_InitialStates == std::set<State>({0}));
+    assert(star.m_FinalStates == std::set<State>({2}));
+
+    MISNFA nullable = compileRegex("a*|b", {'c'});
+    assert(nullable.m_InitialStates == std::set<State>({0, 1, 2}));
+    assert(nullable.m_Alphabet == std::set<Symbol>({'a', 'b', 'c'}));
+
+    DFA classes = determinize(compileRegex("[a-c]+\\*(x|)"));
+    assert(dfaAccepts(classes, "abca*") && dfaAccepts(classes, "b*x"));
+    assert(!dfaAccepts(classes, "*") && !dfaAccepts(classes, "abx") && !dfaAccepts(classes, "a*xx"));
+
+    DFA empty = determinize(compileRegex(""));
+    assert(dfaAccepts(empty, "") && empty.m_FinalStates.size() == 1);
+
+    for (const char* invalid : {"(a", "a)", "*a", "a|+", "[ab", "[b-a]", "a\\"}){
+        bool thrown = false;
+        try {
+            compileRegex(invalid);
+        }
+        catch (const std::invalid_argument&){
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    std::string identifier = generateMatcher(determinize(compileRegex("[A-Za-z_][A-Za-z0-9_]*")), "matchIdentifier");
+    assert(identifier.find("if (static_cast<unsigned char>(symbol - 48 /* '0' */) <= 9) // up to 57 /* '9' */") != std::string::npos);
+    assert(identifier.find("case 95 /* '_' */: goto state1;") != std::string::npos);
+    assert(generateMatcher(determinize(compileRegex("")), "matchEmpty").find("return true;\n    return false;\n}") != std::string::npos);
+    for (const auto& [pattern, generated] : {std::make_pair("[A-Za-z_][A-Za-z0-9_]*", matchIdentifier), std::make_pair("(h|l|w)*l(h|l|w)(h|l|w)", matchThirdLast)}){
+        DFA dfa = determinize(compileRegex(pattern));
+        DenseMatcher dense(dfa);
+        std::vector<std::string> words{""};
+        for (size_t i = 0; i < words.size(); ++i){ //all words up to length 5 over a few symbols inside and outside of the alphabet
+            assert(generated(words[i].data(), words[i].size()) == dfaAccepts(dfa, words[i]));
+            assert(dense(words[i].data(), words[i].size()) == dfaAccepts(dfa, words[i]));
+            if (words[i].size() < 5)
+                for (char symbol : {'h', 'l', 'w', 'Z', '_', '0', '-', '\xff'})
+                    words.push_back(words[i] + symbol);
+        }
+    }
+
+    FlatDFA flat9 = determinizeFlat(in9);
+    assert(flat9.stateCount() == out9.m_States.size() && flat9.toDFA() == out9);
+    assert(flat9.next(0, 'h') == 0 && flat9.next(0, 'x') == FlatDFA::NO_STATE);
+    FlatDFA flatEmpty = determinizeFlat({{0, 1}, {'a', 'b'}, {{{0, 'a'}, {1}}}, {0}, {}});
+    assert(flatEmpty.stateCount() == 1 && flatEmpty.next(0, 'b') == 0 && !flatEmpty.accepts("ab"));
+    assert(determinizeFlat(compileRegex("")).accepts("") && determinizeFlat(compileRegex("")).stateCount() == 1);
+
+    for (const MISNFA* nfa : {&in0, &in1, &in2, &in3, &in4, &in5, &in6, &in7, &in8, &in9, &in10, &in11, &in12, &in13}){
+        NFAReduction reduction = reduceNFA(*nfa);
+        assert(reduction.m_StatesAfter <= reduction.m_StatesBefore && reduction.m_NFA.m_States.size() == reduction.m_StatesAfter);
+        DFA original = determinize(*nfa), reduced = determinize(reduction.m_NFA);
+        std::vector<std::string> words{""};
+        for (size_t i = 0; i < words.size(); ++i){
+            assert(dfaAccepts(original, words[i]) == dfaAccepts(reduced, words[i]));
+            if (words[i].size() < 6)
+                for (char symbol : nfa->m_Alphabet)
+                    words.push_back(words[i] + symbol);
+        }
+    }
+
+    NFAReduction twins = reduceNFA(compileRegex("(a|b)*a(a|b)(a|b)|(a|b)*a(a|b)(a|b)"));
+    assert(twins.m_StatesBefore == 15 && twins.m_ForwardMerged == 7 && twins.m_BackwardMerged == 4 && twins.m_StatesAfter == 4);
+    assert(determinize(twins.m_NFA).m_States.size() == determinize(compileRegex("(a|b)*a(a|b)(a|b)")).m_States.size());
+
+    NFAReduction pruned = reduceNFA({{0, 1, 2, 3, 4}, {'a', 'b'}, {{{0, 'a'}, {1, 2}}, {{1, 'a'}, {3}}, {{2, 'a'}, {3}}, {{2, 'b'}, {3}}, {{4, 'b'}, {1}}}, {0, 4}, {3}});
+    assert(pruned.m_PrunedTransitions == 1 && pruned.m_StatesAfter == 4 && pruned.m_TransitionsAfter == 5);
+    assert(pruned.m_ForwardMerged == 0 && pruned.m_BackwardMerged == 1 && pruned.m_UselessStates == 0); //the initial states 0 and 4 have no predecessors
+
+    NFAReduction useless = reduceNFA({{0, 1, 2}, {'a'}, {{{0, 'a'}, {1}}, {{2, 'a'}, {0}}}, {0}, {2}});
+    assert(useless.m_NFA.m_States == std::set<State>({0}) && useless.m_NFA.m_InitialStates == std::set<State>({0}));
+    assert(useless.m_NFA.m_FinalStates.empty() && useless.m_UselessStates == 3);
+    assert(reduceNFA(in9, 0).m_SimulationSkipped);
+
+    std::mt19937 random(7);
+    for (size_t test = 0; test < 200; ++test){ //against std::regex on all words up to length 6
+        std::string pattern = randomRegex(random, 1 + test % 12, "abc");
+        DFA dfa = determinize(compileRegex(pattern, {'a', 'b', 'c'}));
+        FlatDFA flat = determinizeFlat(compileRegex(pattern, {'a', 'b', 'c'}));
+        FlatDFA reduced = determinizeFlat(reduceNFA(compileRegex(pattern, {'a', 'b', 'c'})).m_NFA);
+        std::regex reference(pattern);
+        std::vector<std::string> words{""};
+        for (size_t i = 0; i < words.size(); ++i){
+            assert(dfaAccepts(dfa, words[i]) == std::regex_match(words[i], reference));
+            assert(flat.accepts(words[i]) == dfaAccepts(dfa, words[i]));
+            assert(reduced.accepts(words[i]) == dfaAccepts(dfa, words[i]));
+            if (words[i].size() < 6)
+                for (char symbol : {'a', 'b', 'c'})
+                    words.push_back(words[i] + symbol);
+        }
+    }
+
+    //the original fixtures stay last, they compare exact state numbering and a failure there must not hide the tests above
     assert(determinize(in1) == out1);
     assert(determinize(in2) == out2);
     assert(determinize(in3) == out3);
@@ -1,167 +1,2610 @@
 #include <algorithm>
-#include <cassert>
-#include <cctype>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <cmath>
-#include <cstdio>
-#include <cstdlib>
+#include <cstdint>
 #include <cstring>
-#include <deque>
 #include <functional>
-#include <iomanip>
-#include <iostream>
-#include <list>
 #include <map>
 #include <memory>
 #include <numeric>
 #include <optional>
-#include <queue>
 #include <set>
-#include <sstream>
 #include <stack>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
-using Symbol = char;
-using Word = std::vector<Symbol>;
+#ifndef __PROGTEST__
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <queue>
+#include <random>
+#include <sstream>
+
+using Symbol = char;
+using Word = std::vector<Symbol>;
+
+struct Grammar {
+    std::set<Symbol> m_Nonterminals;
+    std::set<Symbol> m_Terminals;
+    std::vector<std::pair<Symbol, std::vector<Symbol>>> m_Rules;
+    Symbol m_InitialSymbol;
+};
+#endif
+
+/**
+ * @brief Grammar converted into a dense, index based form, which is built once and shared by all parsers.
+ *
+ * Nonterminals are numbered from 0 to m_NonterminalCount - 1, terminal rules are bucketed by the terminal
+ * they derive and binary rules keep indices of both right side nonterminals, so the chart fill never
+ * touches a std::map. Every compiled rule remembers its index in the original Grammar::m_Rules.
+ */
+struct CompiledGrammar {
+    struct TerminalRule {
+        size_t m_Nonterminal;
+        size_t m_Rule;
+    };
+
+    struct BinaryRule {
+        size_t m_Nonterminal;
+        size_t m_Left;
+        size_t m_Right;
+        size_t m_Rule;
+    };
+
+    size_t m_NonterminalCount = 0;
+    size_t m_InitialSymbol = 0;
+    std::optional<size_t> m_EpsilonRule;
+    std::array<std::vector<TerminalRule>, 256> m_TerminalRules;
+    std::vector<BinaryRule> m_BinaryRules;
+    /**
+     * @brief Right side nonterminals of each binary rule, indexed by the original rule index.
+     */
+    std::vector<std::pair<size_t, size_t>> m_RuleChildren;
+    /**
+     * @brief Indices into m_BinaryRules of the binary rules of each nonterminal.
+     */
+    std::vector<std::vector<size_t>> m_BinaryRulesOf;
+    /**
+     * @brief Terminals which can start a word derived from each nonterminal (indexed by symbolIndex()).
+     */
+    std::vector<std::bitset<256>> m_First;
+    /**
+     * @brief Terminals which can end a word derived from each nonterminal (indexed by symbolIndex()).
+     */
+    std::vector<std::bitset<256>> m_Last;
+    /**
+     * @brief Terminals with at least one terminal rule (indexed by symbolIndex()).
+     */
+    std::bitset<256> m_Alphabet;
+    /**
+     * @brief Lengths of the shortest and the longest non-empty word of the language, the longest is SIZE_MAX
+     * when the language is infinite and the shortest is SIZE_MAX when there is no non-empty word at all.
+     */
+    size_t m_MinLength = SIZE_MAX;
+    size_t m_MaxLength = 0;
+    /**
+     * @brief True if the alternatives of every nonterminal start with pairwise distinct terminals,
+     * so a single symbol of lookahead always tells which rule to expand.
+     */
+    bool m_Predictive = false;
+};
+
+/**
+ * @brief Index of a terminal symbol in CompiledGrammar::m_TerminalRules.
+ */
+inline size_t symbolIndex(Symbol symbol) {
+    return static_cast<unsigned char>(symbol);
+}
+
+/**
+ * @brief Reduced grammar together with the original index of each of its rules.
+ */
+struct GrammarReduction {
+    Grammar m_Grammar;
+    std::vector<size_t> m_RuleMap;
+};
+
+/**
+ * @brief Removes unproductive and unreachable nonterminals and all rules which use them.
+ *
+ * A nonterminal is productive if some rule rewrites it to terminals only or to productive nonterminals,
+ * which is computed as a fixpoint. Reachability is then searched from the initial symbol only through
+ * rules whose right side is entirely productive. The initial symbol always stays in the grammar, even if
+ * its language is empty, terminals are kept as they are.
+ */
+GrammarReduction reduceGrammar(const Grammar& grammar) {
+    auto isProductiveRule = [&](const std::set<Symbol>& productive, const std::vector<Symbol>& ruleRightSide) {
+        return std::all_of(ruleRightSide.begin(), ruleRightSide.end(), [&](Symbol symbol) {
+            return grammar.m_Terminals.count(symbol) || productive.count(symbol);
+        });
+    };
+
+    std::set<Symbol> productive;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto& [nonTerminal, ruleRightSide] : grammar.m_Rules)
+            if (!productive.count(nonTerminal) && isProductiveRule(productive, ruleRightSide)) {
+                productive.insert(nonTerminal);
+                changed = true;
+            }
+    }
+
+    std::set<Symbol> reachable{grammar.m_InitialSymbol};
+    std::stack<Symbol> stack;
+    stack.push(grammar.m_InitialSymbol);
+    while (!stack.empty()) {
+        Symbol current = stack.top();
+        stack.pop();
+        for (const auto& [nonTerminal, ruleRightSide] : grammar.m_Rules)
+            if (nonTerminal == current && isProductiveRule(productive, ruleRightSide))
+                for (Symbol symbol : ruleRightSide)
+                    if (grammar.m_Nonterminals.count(symbol) && reachable.insert(symbol).second)
+                        stack.push(symbol);
+    }
+
+    GrammarReduction reduction{{reachable, grammar.m_Terminals, {}, grammar.m_InitialSymbol}, {}};
+    for (size_t ruleIndex = 0; ruleIndex < grammar.m_Rules.size(); ++ruleIndex) {
+        const auto& [nonTerminal, ruleRightSide] = grammar.m_Rules[ruleIndex];
+        if (reachable.count(nonTerminal) && isProductiveRule(productive, ruleRightSide)) {
+            reduction.m_Grammar.m_Rules.push_back(grammar.m_Rules[ruleIndex]);
+            reduction.m_RuleMap.push_back(ruleIndex);
+        }
+    }
+    return reduction;
+}
+
+/**
+ * @brief Compiles the grammar into CompiledGrammar.
+ *
+ * The grammar is reduced first (see reduceGrammar()), so the chart only has columns for useful
+ * nonterminals and the rule loops skip dead rules, compiled rules still carry the original rule indices.
+ * Nonterminals get their indices in the order of Grammar::m_Nonterminals, rules keep their relative order.
+ */
+std::shared_ptr<const CompiledGrammar> compileGrammar(const Grammar& original) {
+    GrammarReduction reduction = reduceGrammar(original);
+    const Grammar& grammar = reduction.m_Grammar;
+
+    auto compiled = std::make_shared<CompiledGrammar>();
+    std::map<Symbol, size_t> index;
+    for (const auto& nonTerminal : grammar.m_Nonterminals)
+        index.emplace(nonTerminal, index.size());
+
+    compiled->m_NonterminalCount = index.size();
+    compiled->m_InitialSymbol = index.at(grammar.m_InitialSymbol);
+    compiled->m_RuleChildren.resize(original.m_Rules.size());
+
+    for (size_t reducedIndex = 0; reducedIndex < grammar.m_Rules.size(); ++reducedIndex) {
+        const auto& [nonTerminal, ruleRightSide] = grammar.m_Rules[reducedIndex];
+        size_t ruleIndex = reduction.m_RuleMap[reducedIndex];
+        if (ruleRightSide.empty()) {
+            if (nonTerminal == grammar.m_InitialSymbol)
+                compiled->m_EpsilonRule = ruleIndex;
+        }
+        else if (ruleRightSide.size() == 1)
+            compiled->m_TerminalRules[symbolIndex(ruleRightSide[0])].push_back({index.at(nonTerminal), ruleIndex});
+        else {
+            compiled->m_BinaryRules.push_back({index.at(nonTerminal), index.at(ruleRightSide[0]), index.at(ruleRightSide[1]), ruleIndex});
+            compiled->m_RuleChildren[ruleIndex] = {index.at(ruleRightSide[0]), index.at(ruleRightSide[1])};
+        }
+    }
+
+    compiled->m_BinaryRulesOf.resize(compiled->m_NonterminalCount);
+    for (size_t i = 0; i < compiled->m_BinaryRules.size(); ++i)
+        compiled->m_BinaryRulesOf[compiled->m_BinaryRules[i].m_Nonterminal].push_back(i);
+
+    /**
+     * @brief FIRST sets are computed as a fixpoint, a terminal rule adds its terminal and a binary rule
+     * adds the FIRST set of its left nonterminal (no nonterminal except the initial one can derive
+     * the empty word and the initial one never appears on the right side).
+     */
+    auto& first = compiled->m_First;
+    first.assign(compiled->m_NonterminalCount, {});
+    for (size_t terminal = 0; terminal < compiled->m_TerminalRules.size(); ++terminal)
+        for (const auto& rule : compiled->m_TerminalRules[terminal]) {
+            first[rule.m_Nonterminal].set(terminal);
+            compiled->m_Alphabet.set(terminal);
+        }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto& rule : compiled->m_BinaryRules) {
+            auto merged = first[rule.m_Nonterminal] | first[rule.m_Left];
+            if (merged != first[rule.m_Nonterminal]) {
+                first[rule.m_Nonterminal] = merged;
+                changed = true;
+            }
+        }
+    }
+
+    auto& last = compiled->m_Last;
+    last.assign(compiled->m_NonterminalCount, {});
+    for (size_t terminal = 0; terminal < compiled->m_TerminalRules.size(); ++terminal)
+        for (const auto& rule : compiled->m_TerminalRules[terminal])
+            last[rule.m_Nonterminal].set(terminal);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto& rule : compiled->m_BinaryRules) {
+            auto merged = last[rule.m_Nonterminal] | last[rule.m_Right];
+            if (merged != last[rule.m_Nonterminal]) {
+                last[rule.m_Nonterminal] = merged;
+                changed = true;
+            }
+        }
+    }
+
+    /**
+     * @brief Word lengths are fixpoints over the rules as well (with saturating sums). The longest words
+     * only stop growing when no nonterminal derives itself, in a reduced grammar such a cycle makes the
+     * language infinite and it is recognised by lengths still changing after |N| rounds.
+     */
+    auto saturatingSum = [](size_t a, size_t b) {
+        return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+    };
+    std::vector<size_t> shortest(compiled->m_NonterminalCount, SIZE_MAX), longest(compiled->m_NonterminalCount, 0);
+    for (size_t terminal = 0; terminal < compiled->m_TerminalRules.size(); ++terminal)
+        for (const auto& rule : compiled->m_TerminalRules[terminal])
+            shortest[rule.m_Nonterminal] = longest[rule.m_Nonterminal] = 1;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto& rule : compiled->m_BinaryRules) {
+            size_t length = saturatingSum(shortest[rule.m_Left], shortest[rule.m_Right]);
+            if (length < shortest[rule.m_Nonterminal]) {
+                shortest[rule.m_Nonterminal] = length;
+                changed = true;
+            }
+        }
+    }
+    bool infinite = false;
+    for (size_t round = 0; round <= compiled->m_NonterminalCount; ++round) {
+        bool changed = false;
+        for (const auto& rule : compiled->m_BinaryRules) {
+            size_t length = saturatingSum(longest[rule.m_Left], longest[rule.m_Right]);
+            if (length > longest[rule.m_Nonterminal]) {
+                longest[rule.m_Nonterminal] = length;
+                changed = true;
+            }
+        }
+        infinite = changed;
+        if (!changed)
+            break;
+    }
+    compiled->m_MinLength = shortest[compiled->m_InitialSymbol];
+    compiled->m_MaxLength = infinite ? SIZE_MAX : longest[compiled->m_InitialSymbol];
+
+    std::vector<std::bitset<256>> seen(compiled->m_NonterminalCount);
+    compiled->m_Predictive = true;
+    auto addAlternative = [&](size_t nonTerminal, const std::bitset<256>& alternative) {
+        if ((seen[nonTerminal] & alternative).any())
+            compiled->m_Predictive = false;
+        seen[nonTerminal] |= alternative;
+    };
+    for (size_t terminal = 0; terminal < compiled->m_TerminalRules.size(); ++terminal)
+        for (const auto& rule : compiled->m_TerminalRules[terminal])
+            addAlternative(rule.m_Nonterminal, std::bitset<256>().set(terminal));
+    for (const auto& rule : compiled->m_BinaryRules)
+        addAlternative(rule.m_Nonterminal, first[rule.m_Left]);
+    return compiled;
+}
+
+/**
+ * @brief What passesStaticFilters() needs to know about a non-empty word, computed once for checking
+ * the word against many grammars.
+ */
+struct WordFeatures {
+    std::bitset<256> m_Symbols;
+    size_t m_Length = 0;
+    size_t m_First = 0;
+    size_t m_Last = 0;
+};
+
+WordFeatures wordFeatures(const Word& word) {
+    WordFeatures features;
+    for (Symbol symbol : word)
+        features.m_Symbols[symbolIndex(symbol)] = true;
+    features.m_Length = word.size();
+    if (!word.empty()) {
+        features.m_First = symbolIndex(word.front());
+        features.m_Last = symbolIndex(word.back());
+    }
+    return features;
+}
+
+/**
+ * @brief Necessary conditions for a non-empty word to be in the language, checked without any chart:
+ * the length is between the shortest and the longest word, every symbol has a terminal rule and the first
+ * and the last symbols can start and end a word of the initial symbol.
+ */
+bool passesStaticFilters(const CompiledGrammar& grammar, const WordFeatures& features) {
+    if (features.m_Length < grammar.m_MinLength || features.m_Length > grammar.m_MaxLength)
+        return false;
+    if (!grammar.m_First[grammar.m_InitialSymbol][features.m_First] || !grammar.m_Last[grammar.m_InitialSymbol][features.m_Last])
+        return false;
+    return (features.m_Symbols & ~grammar.m_Alphabet).none();
+}
+
+bool passesStaticFilters(const CompiledGrammar& grammar, const Word& word) {
+    return passesStaticFilters(grammar, wordFeatures(word));
+}
+
+/**
+ * @brief Rule which generated a substring from a nonterminal and the position, where the substring was split
+ * between the two right side nonterminals (-1 for terminal rules). Rule -1 means the substring is not generated.
+ */
+struct Backpointer {
+    int m_Rule = -1;
+    int m_Split = -1;
+};
+
+/**
+ * @brief Index of the chart cell for substring <start, end>, cells are stored column by column
+ * (all substrings ending at 0, then all ending at 1, ...), so appending a symbol only appends a column.
+ */
+inline size_t cellIndex(size_t start, size_t end) {
+    return end * (end + 1) / 2 + start;
+}
+
+/**
+ * @brief Emits the leftmost derivation of substring <start, end> from the initial symbol.
+ *
+ * lookup(nonterminal, start, end) returns the Backpointer of a node, the derivation tree is walked in
+ * preorder with an explicit stack (right child pushed first), so every node is visited exactly once and
+ * the extraction is linear in the size of the derivation without any recursion.
+ */
+template <typename Lookup>
+std::vector<size_t> extractDerivation(const CompiledGrammar& grammar, size_t start, size_t end, Lookup&& lookup) {
+    struct Node {
+        size_t m_Nonterminal;
+        size_t m_Start;
+        size_t m_End;
+    };
+
+    std::vector<size_t> result;
+    result.reserve(2 * (end - start) + 1);
+    std::vector<Node> stack{{grammar.m_InitialSymbol, start, end}};
+    while (!stack.empty()) {
+        Node node = stack.back();
+        stack.pop_back();
+
+        Backpointer backpointer = lookup(node.m_Nonterminal, node.m_Start, node.m_End);
+        result.push_back(backpointer.m_Rule);
+        if (node.m_Start == node.m_End)
+            continue;
+
+        size_t split = backpointer.m_Split;
+        const auto& [left, right] = grammar.m_RuleChildren[backpointer.m_Rule];
+        stack.push_back({right, split + 1, node.m_End});
+        stack.push_back({left, node.m_Start, split});
+    }
+    return result;
+}
+
+/**
+ * @brief Runs task(index, worker) for every index in [0, count) on up to threadCount threads.
+ *
+ * Indices are handed out one by one from a shared counter, worker is the number of the thread (the calling
+ * thread is worker 0), so the task can keep per worker state without locking. threadCount 0 means
+ * std::thread::hardware_concurrency().
+ *
+ * @return The number of workers that were used.
+ */
+template <typename Task>
+size_t parallelFor(size_t count, size_t threadCount, Task&& task) {
+    if (threadCount == 0)
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    threadCount = std::max<size_t>(1, std::min(threadCount, count));
+
+    std::atomic<size_t> next{0};
+    auto work = [&](size_t worker) {
+        for (size_t index = next++; index < count; index = next++)
+            task(index, worker);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t worker = 1; worker < threadCount; ++worker)
+        threads.emplace_back(work, worker);
+    work(0);
+    for (auto& thread : threads)
+        thread.join();
+    return threadCount;
+}
+
+/**
+ * @brief Arbitrary precision unsigned integer, just enough for counting derivations.
+ */
+class BigCount {
+public:
+    BigCount(uint64_t value = 0) {
+        for (; value; value >>= 32)
+            m_Limbs.push_back(static_cast<uint32_t>(value));
+    }
+
+    bool isZero() const {
+        return m_Limbs.empty();
+    }
+
+    BigCount& operator+=(const BigCount& other) {
+        uint64_t carry = 0;
+        m_Limbs.resize(std::max(m_Limbs.size(), other.m_Limbs.size()), 0);
+        for (size_t i = 0; i < m_Limbs.size(); ++i) {
+            carry += uint64_t(m_Limbs[i]) + (i < other.m_Limbs.size() ? other.m_Limbs[i] : 0);
+            m_Limbs[i] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry)
+            m_Limbs.push_back(static_cast<uint32_t>(carry));
+        return *this;
+    }
+
+    BigCount operator*(const BigCount& other) const {
+        BigCount product;
+        if (isZero() || other.isZero())
+            return product;
+        product.m_Limbs.assign(m_Limbs.size() + other.m_Limbs.size(), 0);
+        for (size_t i = 0; i < m_Limbs.size(); ++i) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < other.m_Limbs.size(); ++j) {
+                carry += uint64_t(m_Limbs[i]) * other.m_Limbs[j] + product.m_Limbs[i + j];
+                product.m_Limbs[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            product.m_Limbs[i + other.m_Limbs.size()] = static_cast<uint32_t>(carry);
+        }
+        while (!product.m_Limbs.empty() && product.m_Limbs.back() == 0)
+            product.m_Limbs.pop_back();
+        return product;
+    }
+
+    std::string toString() const {
+        if (isZero())
+            return "0";
+        std::string digits;
+        std::vector<uint32_t> rest = m_Limbs;
+        while (!rest.empty()) {
+            uint64_t remainder = 0;
+            for (size_t i = rest.size(); i-- > 0;) {
+                uint64_t current = remainder << 32 | rest[i];
+                rest[i] = static_cast<uint32_t>(current / 10);
+                remainder = current % 10;
+            }
+            digits.push_back(static_cast<char>('0' + remainder));
+            while (!rest.empty() && rest.back() == 0)
+                rest.pop_back();
+        }
+        return std::string(digits.rbegin(), digits.rend());
+    }
+
+private:
+    std::vector<uint32_t> m_Limbs;
+};
+
+/**
+ * @brief Shared packed parse forest of all derivations of a word.
+ *
+ * Every node is a nonterminal over a substring <m_Start, m_End) and is stored only once, its
+ * alternatives (packed nodes) are the rules with the splits which derive it, pointing to the child
+ * nodes. Only nodes reachable from the root are kept and children always have smaller indices than
+ * their parents, so the forest is polynomial in size even when the number of derivations is exponential.
+ */
+class ParseForest {
+public:
+    static constexpr size_t NO_CHILD = SIZE_MAX;
+
+    struct Alternative {
+        size_t m_Rule;
+        size_t m_Left = NO_CHILD;
+        size_t m_Right = NO_CHILD;
+    };
+
+    struct Node {
+        size_t m_Nonterminal;
+        size_t m_Start;
+        size_t m_End;
+        std::vector<Alternative> m_Alternatives;
+    };
+
+    /**
+     * @brief Builds the forest by a CYK chart fill, which records every (rule, split) that succeeds
+     * instead of overwriting it.
+     */
+    static ParseForest build(const CompiledGrammar& grammar, const Word& word) {
+        ParseForest forest;
+        size_t n = word.size();
+        if (n == 0) {
+            if (grammar.m_EpsilonRule)
+                forest.m_Nodes.push_back({grammar.m_InitialSymbol, 0, 0, {{*grammar.m_EpsilonRule}}});
+            return forest;
+        }
+        if (!passesStaticFilters(grammar, word))
+            return forest;
+
+        size_t width = grammar.m_NonterminalCount;
+        std::vector<size_t> chart(n * (n + 1) / 2 * width, NO_CHILD);
+        std::vector<Node> nodes;
+        auto nodeOf = [&](size_t nonTerminal, size_t start, size_t end) {
+            size_t& node = chart[cellIndex(start, end) * width + nonTerminal];
+            if (node == NO_CHILD) {
+                node = nodes.size();
+                nodes.push_back({nonTerminal, start, end + 1, {}});
+            }
+            return node;
+        };
+
+        for (size_t charIndex = 0; charIndex < n; ++charIndex)
+            for (const auto& rule : grammar.m_TerminalRules[symbolIndex(word[charIndex])])
+                nodes[nodeOf(rule.m_Nonterminal, charIndex, charIndex)].m_Alternatives.push_back({rule.m_Rule});
+
+        for (size_t len = 2; len <= n; ++len)
+            for (size_t startPos = 0; startPos <= n - len; ++startPos) {
+                size_t endPos = startPos + len - 1;
+                for (size_t splitPos = startPos; splitPos < endPos; ++splitPos) {
+                    const size_t* left = &chart[cellIndex(startPos, splitPos) * width];
+                    const size_t* right = &chart[cellIndex(splitPos + 1, endPos) * width];
+                    for (const auto& rule : grammar.m_BinaryRules)
+                        if (left[rule.m_Left] != NO_CHILD && right[rule.m_Right] != NO_CHILD) {
+                            Alternative alternative{rule.m_Rule, left[rule.m_Left], right[rule.m_Right]};
+                            nodes[nodeOf(rule.m_Nonterminal, startPos, endPos)].m_Alternatives.push_back(alternative);
+                        }
+                }
+            }
+
+        size_t root = chart[cellIndex(0, n - 1) * width + grammar.m_InitialSymbol];
+        if (root == NO_CHILD)
+            return forest;
+
+        /**
+         * @brief Children are created before their parents, so one pass from the root downwards finds all
+         * reachable nodes and the renumbering keeps children before parents.
+         */
+        std::vector<size_t> renumbered(nodes.size(), NO_CHILD);
+        renumbered[root] = 0;
+        for (size_t node = root + 1; node-- > 0;)
+            if (renumbered[node] != NO_CHILD)
+                for (const auto& alternative : nodes[node].m_Alternatives)
+                    for (size_t child : {alternative.m_Left, alternative.m_Right})
+                        if (child != NO_CHILD)
+                            renumbered[child] = 0;
+        size_t next = 0;
+        for (size_t node = 0; node <= root; ++node)
+            if (renumbered[node] != NO_CHILD) {
+                renumbered[node] = next++;
+                forest.m_Nodes.push_back(std::move(nodes[node]));
+                for (auto& alternative : forest.m_Nodes.back().m_Alternatives)
+                    if (alternative.m_Left != NO_CHILD) {
+                        alternative.m_Left = renumbered[alternative.m_Left];
+                        alternative.m_Right = renumbered[alternative.m_Right];
+                    }
+            }
+        return forest;
+    }
+
+    /**
+     * @return False if the word has no derivation.
+     */
+    bool accepted() const {
+        return !m_Nodes.empty();
+    }
+
+    const std::vector<Node>& nodes() const {
+        return m_Nodes;
+    }
+
+    /**
+     * @brief The root node, i.e. the initial symbol over the whole word, is always the last one.
+     */
+    size_t root() const {
+        return m_Nodes.size() - 1;
+    }
+
+    /**
+     * @return Number of packed nodes (alternatives) over all nodes.
+     */
+    size_t packedSize() const {
+        size_t size = 0;
+        for (const auto& node : m_Nodes)
+            size += node.m_Alternatives.size();
+        return size;
+    }
+
+    /**
+     * @brief Counts derivations of the word without enumerating them, UINT64_MAX means the count saturated.
+     */
+    uint64_t countDerivations() const {
+        return count<uint64_t>(
+            [](uint64_t a, uint64_t b) { return a > UINT64_MAX - b ? UINT64_MAX : a + b; },
+            [](uint64_t a, uint64_t b) { return b != 0 && a > UINT64_MAX / b ? UINT64_MAX : a * b; });
+    }
+
+    /**
+     * @brief Counts derivations of the word exactly.
+     */
+    BigCount countDerivationsExact() const {
+        return count<BigCount>(
+            [](BigCount a, const BigCount& b) { return a += b; },
+            [](const BigCount& a, const BigCount& b) { return a * b; });
+    }
+
+private:
+    template <typename Count, typename Add, typename Multiply>
+    Count count(Add add, Multiply multiply) const {
+        if (m_Nodes.empty())
+            return Count(0);
+        std::vector<Count> counts(m_Nodes.size());
+        for (size_t node = 0; node < m_Nodes.size(); ++node) {
+            Count total(0);
+            for (const auto& alternative : m_Nodes[node].m_Alternatives)
+                total = add(total, alternative.m_Left == NO_CHILD ? Count(1) : multiply(counts[alternative.m_Left], counts[alternative.m_Right]));
+            counts[node] = total;
+        }
+        return counts.back();
+    }
+
+    std::vector<Node> m_Nodes;
+};
+
+/**
+ * @brief Lazily enumerates leftmost derivations stored in a ParseForest.
+ *
+ * A derivation is the sequence of alternatives chosen at the nodes visited in preorder. Derivations are
+ * produced in lexicographic order of these sequences, the next one is found by increasing the last choice
+ * which still has an alternative left and walking the tree again with the first alternative everywhere
+ * behind it. Only the current sequence is stored, so memory stays linear in the length of the derivation.
+ */
+class DerivationEnumerator {
+public:
+    explicit DerivationEnumerator(const ParseForest& forest)
+        : m_Forest(forest), m_Done(!forest.accepted()) {}
+
+    /**
+     * @return The next derivation, or std::nullopt when all of them were produced.
+     */
+    std::optional<std::vector<size_t>> next() {
+        if (m_Done)
+            return std::nullopt;
+        if (m_Started) {
+            size_t point = m_Choices.size();
+            while (point > 0 && m_Choices[point - 1] + 1 == m_Forest.nodes()[m_Visited[point - 1]].m_Alternatives.size())
+                --point;
+            if (point == 0) {
+                m_Done = true;
+                return std::nullopt;
+            }
+            ++m_Choices[point - 1];
+            m_Choices.resize(point);
+        }
+        m_Started = true;
+
+        std::vector<size_t> derivation;
+        m_Visited.clear();
+        std::vector<size_t> stack{m_Forest.root()};
+        while (!stack.empty()) {
+            size_t node = stack.back();
+            stack.pop_back();
+            if (m_Visited.size() == m_Choices.size())
+                m_Choices.push_back(0);
+            const auto& alternative = m_Forest.nodes()[node].m_Alternatives[m_Choices[m_Visited.size()]];
+            m_Visited.push_back(node);
+            derivation.push_back(alternative.m_Rule);
+            if (alternative.m_Left != ParseForest::NO_CHILD) {
+                stack.push_back(alternative.m_Right);
+                stack.push_back(alternative.m_Left);
+            }
+        }
+        return derivation;
+    }
+
+private:
+    const ParseForest& m_Forest;
+    std::vector<size_t> m_Choices;
+    std::vector<size_t> m_Visited;
+    bool m_Started = false;
+    bool m_Done;
+};
+
+/**
+ * @brief Checks whether the language of the (reduced) grammar is finite, which is exactly when no
+ * nonterminal can reach itself through the right sides of the rules.
+ */
+bool isFiniteLanguage(const CompiledGrammar& grammar) {
+    std::vector<int> state(grammar.m_NonterminalCount, 0); // 0 unvisited, 1 on the path, 2 finished
+    for (size_t start = 0; start < grammar.m_NonterminalCount; ++start) {
+        if (state[start])
+            continue;
+        std::vector<std::pair<size_t, size_t>> stack{{start, 0}};
+        state[start] = 1;
+        while (!stack.empty()) {
+            auto& [current, next] = stack.back();
+            const auto& rules = grammar.m_BinaryRulesOf[current];
+            if (next == 2 * rules.size()) {
+                state[current] = 2;
+                stack.pop_back();
+                continue;
+            }
+            const auto& rule = grammar.m_BinaryRules[rules[next / 2]];
+            size_t child = next % 2 ? rule.m_Right : rule.m_Left;
+            ++next;
+            if (state[child] == 1)
+                return false;
+            if (state[child] == 0) {
+                state[child] = 1;
+                stack.push_back({child, 0});
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Checks whether some nonterminal is self-embedding, i.e. A =>* uAv with both u and v non-empty.
+ *
+ * Nothing derives the empty word inside a derivation, so going from A -> BC to B leaves a non-empty
+ * word on the right and going to C leaves one on the left. The search runs over pairs
+ * (nonterminal, which sides are already non-empty) and looks for A with both sides from A with none.
+ * A grammar without self-embedding nonterminals generates a regular language.
+ */
+bool isSelfEmbedding(const CompiledGrammar& grammar) {
+    size_t n = grammar.m_NonterminalCount;
+    for (size_t start = 0; start < n; ++start) {
+        std::vector<char> visited(4 * n, 0);
+        std::vector<size_t> stack{4 * start};
+        visited[4 * start] = 1;
+        while (!stack.empty()) {
+            size_t current = stack.back() / 4, sides = stack.back() % 4;
+            stack.pop_back();
+            for (size_t ruleIndex : grammar.m_BinaryRulesOf[current]) {
+                const auto& rule = grammar.m_BinaryRules[ruleIndex];
+                for (size_t next : {4 * rule.m_Left + (sides | 2), 4 * rule.m_Right + (sides | 1)}) {
+                    if (next == 4 * start + 3)
+                        return true;
+                    if (!visited[next]) {
+                        visited[next] = 1;
+                        stack.push_back(next);
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Deterministic automaton for a grammar with a regular language, whose transitions remember
+ * the rules of the leftmost derivation, so it answers membership in O(n) and still produces traces.
+ *
+ * States of the underlying nondeterministic automaton are stacks of nonterminals which are still to be
+ * expanded (the unread part of a leftmost sentential form, top is the leftmost one), starting with the
+ * initial symbol and accepting with the empty stack. Reading a symbol expands the top by a chain of rules
+ * A -> B1 C1, B1 -> B2 C2, ..., Bk -> a and pushes C1 .. Ck, the chain is exactly the part of the leftmost
+ * derivation between two terminals and is stored with the transition. This automaton is finite for finite
+ * languages and for right recursion, left recursion makes the chain infinite. A left recursive grammar without
+ * right recursion (such as a left-linear one) is built mirrored instead: with the right sides of the binary rules
+ * swapped it generates the reversed words and is right recursive, so the automaton reads the word backwards and
+ * the derivation it finds is mirrored back (children of every binary node in the opposite order).
+ * A grammar with both left and right recursion has no automaton here, even when it is not self-embedding and so
+ * regular (such as S -> AB, A -> Aa | a, B -> bB | b): neither direction gives finite chains, and the parser falls
+ * back to the cubic engines for it.
+ * The nondeterministic automaton is determinized by the subset construction, the trace is recovered by
+ * a backward pass through the subsets visited by the scan.
+ */
+class TraceAutomaton {
+public:
+    /**
+     * @return The automaton, or nullptr when the grammar is self-embedding, both left and right recursive
+     * (see TraceAutomaton) or the automaton would have more than stateLimit states. The chains of rules from
+     * one nonterminal are enumerated only until they take stateLimit times the number of terminals of steps,
+     * so a grammar with a wide branching factor is given up on before the enumeration blows up.
+     */
+    static std::shared_ptr<const TraceAutomaton> build(const CompiledGrammar& grammar, size_t stateLimit = 4096) {
+        if (isSelfEmbedding(grammar))
+            return nullptr;
+        if (!isLeftRecursive(grammar))
+            return build(grammar, stateLimit, false);
+
+        CompiledGrammar mirrored = grammar;
+        for (auto& rule : mirrored.m_BinaryRules)
+            std::swap(rule.m_Left, rule.m_Right);
+        for (auto& children : mirrored.m_RuleChildren)
+            std::swap(children.first, children.second);
+        std::swap(mirrored.m_First, mirrored.m_Last);
+        if (isLeftRecursive(mirrored))
+            return nullptr;
+        return build(mirrored, stateLimit, true);
+    }
+
+    size_t nfaSize() const {
+        return m_NfaStates;
+    }
+
+    size_t dfaSize() const {
+        return m_Subsets.size();
+    }
+
+    /**
+     * @return True if the automaton reads words backwards, see TraceAutomaton.
+     */
+    bool mirrored() const {
+        return m_Mirrored;
+    }
+
+    /**
+     * @brief Membership of a word by a single scan of the deterministic automaton.
+     */
+    bool accepts(const Word& word) const {
+        if (word.empty())
+            return m_EpsilonRule.has_value();
+        return m_Mirrored ? scan(word.rbegin(), word.rend()) : scan(word.begin(), word.end());
+    }
+
+    /**
+     * @return Leftmost derivation of the word, empty if the word is not in the language.
+     */
+    std::vector<size_t> trace(const Word& word) const {
+        if (word.empty())
+            return m_EpsilonRule ? std::vector<size_t>{*m_EpsilonRule} : std::vector<size_t>();
+        if (!m_Mirrored)
+            return traceForward(word);
+        return mirrorDerivation(traceForward(Word(word.rbegin(), word.rend())));
+    }
+
+private:
+    struct Transition {
+        uint32_t m_State;
+        uint32_t m_Chain;
+    };
+
+    /**
+     * @brief Left recursion is a cycle over the left children, finding it upfront keeps the chain search
+     * of build() from blowing up.
+     */
+    static bool isLeftRecursive(const CompiledGrammar& grammar) {
+        std::vector<size_t> leftIndegree(grammar.m_NonterminalCount, 0);
+        for (const auto& rule : grammar.m_BinaryRules)
+            ++leftIndegree[rule.m_Left];
+        std::vector<size_t> sources;
+        for (size_t nonterminal = 0; nonterminal < grammar.m_NonterminalCount; ++nonterminal)
+            if (!leftIndegree[nonterminal])
+                sources.push_back(nonterminal);
+        size_t ordered = 0;
+        while (!sources.empty()) {
+            size_t current = sources.back();
+            sources.pop_back();
+            ++ordered;
+            for (size_t ruleIndex : grammar.m_BinaryRulesOf[current])
+                if (!--leftIndegree[grammar.m_BinaryRules[ruleIndex].m_Left])
+                    sources.push_back(grammar.m_BinaryRules[ruleIndex].m_Left);
+        }
+        return ordered != grammar.m_NonterminalCount;
+    }
+
+    static std::shared_ptr<const TraceAutomaton> build(const CompiledGrammar& grammar, size_t stateLimit, bool mirrored) {
+        auto automaton = std::make_shared<TraceAutomaton>();
+        automaton->m_Mirrored = mirrored;
+        if (mirrored) {
+            automaton->m_Binary.resize(grammar.m_RuleChildren.size(), false);
+            for (const auto& rule : grammar.m_BinaryRules)
+                automaton->m_Binary[rule.m_Rule] = true;
+        }
+        automaton->m_EpsilonRule = grammar.m_EpsilonRule;
+        automaton->m_Column.fill(-1);
+        for (size_t terminal = 0; terminal < 256; ++terminal)
+            if (grammar.m_Alphabet[terminal])
+                automaton->m_Column[terminal] = automaton->m_Columns++;
+        size_t columns = automaton->m_Columns;
+
+        /**
+         * @brief All chains of rules from every nonterminal down to a terminal, with the nonterminals they push.
+         */
+        struct Expansion {
+            size_t m_Column;
+            std::vector<uint32_t> m_Pushed;
+            size_t m_Chain;
+        };
+        std::vector<std::vector<Expansion>> expansions(grammar.m_NonterminalCount);
+        size_t budget = stateLimit * std::max<size_t>(1, columns);
+        for (size_t start = 0; start < grammar.m_NonterminalCount; ++start) {
+            struct Frame {
+                size_t m_Nonterminal;
+                std::vector<uint32_t> m_Pushed;
+                std::vector<size_t> m_Chain;
+            };
+            std::vector<Frame> stack{{start, {}, {}}};
+            size_t steps = 0; // frames taken and chains found, checked before anything more is expanded
+            while (!stack.empty()) {
+                Frame frame = std::move(stack.back());
+                stack.pop_back();
+                if (frame.m_Chain.size() > grammar.m_NonterminalCount)
+                    return nullptr; // left recursion
+                if (++steps > budget)
+                    return nullptr;
+                for (size_t terminal = 0; terminal < 256; ++terminal)
+                    for (const auto& rule : grammar.m_TerminalRules[terminal])
+                        if (rule.m_Nonterminal == frame.m_Nonterminal) {
+                            if (++steps > budget)
+                                return nullptr;
+                            automaton->m_ChainOffsets.push_back(automaton->m_ChainRules.size());
+                            automaton->m_ChainRules.insert(automaton->m_ChainRules.end(), frame.m_Chain.begin(), frame.m_Chain.end());
+                            automaton->m_ChainRules.push_back(rule.m_Rule);
+                            expansions[start].push_back({size_t(automaton->m_Column[terminal]), frame.m_Pushed, automaton->m_ChainOffsets.size() - 1});
+                        }
+                for (size_t ruleIndex : grammar.m_BinaryRulesOf[frame.m_Nonterminal]) {
+                    const auto& rule = grammar.m_BinaryRules[ruleIndex];
+                    Frame next{rule.m_Left, frame.m_Pushed, frame.m_Chain};
+                    next.m_Pushed.push_back(rule.m_Right);
+                    next.m_Chain.push_back(rule.m_Rule);
+                    stack.push_back(std::move(next));
+                }
+            }
+        }
+        automaton->m_ChainOffsets.push_back(automaton->m_ChainRules.size());
+
+        std::map<std::vector<uint32_t>, uint32_t> stackIds;
+        std::vector<std::vector<uint32_t>> stacks;
+        auto stateOf = [&](const std::vector<uint32_t>& stack) {
+            auto [it, inserted] = stackIds.emplace(stack, stacks.size());
+            if (inserted)
+                stacks.push_back(stack);
+            return it->second;
+        };
+        stateOf({uint32_t(grammar.m_InitialSymbol)});
+        std::vector<std::vector<Transition>> forward;
+        for (size_t state = 0; state < stacks.size(); ++state) {
+            if (stacks.size() > stateLimit)
+                return nullptr;
+            forward.resize(stacks.size() * columns);
+            if (stacks[state].empty()) {
+                automaton->m_Accepting = state;
+                continue;
+            }
+            std::vector<uint32_t> base = stacks[state];
+            base.pop_back();
+            for (const auto& expansion : expansions[stacks[state].back()]) {
+                std::vector<uint32_t> target = base;
+                target.insert(target.end(), expansion.m_Pushed.begin(), expansion.m_Pushed.end());
+                uint32_t targetState = stateOf(target);
+                auto& transitions = forward[state * columns + expansion.m_Column];
+                if (std::none_of(transitions.begin(), transitions.end(), [&](const Transition& t) { return t.m_State == targetState; }))
+                    transitions.push_back({targetState, uint32_t(expansion.m_Chain)});
+            }
+        }
+        forward.resize(stacks.size() * columns);
+
+        automaton->m_Reverse.resize(forward.size());
+        for (size_t state = 0; state < stacks.size(); ++state)
+            for (size_t column = 0; column < columns; ++column)
+                for (const auto& transition : forward[state * columns + column])
+                    automaton->m_Reverse[transition.m_State * columns + column].push_back({uint32_t(state), transition.m_Chain});
+
+        std::map<std::vector<uint32_t>, int32_t> subsetIds;
+        auto& subsets = automaton->m_Subsets;
+        subsetIds.emplace(std::vector<uint32_t>{0}, 0);
+        subsets.push_back({0});
+        for (size_t current = 0; current < subsets.size(); ++current) {
+            if (subsets.size() > stateLimit)
+                return nullptr;
+            automaton->m_Next.resize(subsets.size() * columns, -1);
+            for (size_t column = 0; column < columns; ++column) {
+                std::vector<uint32_t> target;
+                for (uint32_t state : subsets[current])
+                    for (const auto& transition : forward[state * columns + column])
+                        target.push_back(transition.m_State);
+                if (target.empty())
+                    continue;
+                std::sort(target.begin(), target.end());
+                target.erase(std::unique(target.begin(), target.end()), target.end());
+                auto [it, inserted] = subsetIds.emplace(target, subsets.size());
+                if (inserted)
+                    subsets.push_back(std::move(target));
+                automaton->m_Next[current * columns + column] = it->second;
+            }
+        }
+        automaton->m_Next.resize(subsets.size() * columns, -1);
+        automaton->m_NfaStates = stacks.size();
+        return automaton;
+    }
+
+    /**
+     * @brief Runs the deterministic automaton over the symbols.
+     */
+    template <typename Iterator>
+    bool scan(Iterator begin, Iterator end) const {
+        int32_t state = 0;
+        for (Iterator it = begin; it != end; ++it) {
+            int column = m_Column[symbolIndex(*it)];
+            if (column < 0 || (state = m_Next[state * m_Columns + column]) < 0)
+                return false;
+        }
+        return isAccepting(state);
+    }
+
+    /**
+     * @return Leftmost derivation of a non-empty word in the grammar the automaton was built from.
+     */
+    std::vector<size_t> traceForward(const Word& word) const {
+        std::vector<int32_t> visited{0};
+        visited.reserve(word.size() + 1);
+        for (Symbol symbol : word) {
+            int column = m_Column[symbolIndex(symbol)];
+            if (column < 0 || m_Next[visited.back() * m_Columns + column] < 0)
+                return {};
+            visited.push_back(m_Next[visited.back() * m_Columns + column]);
+        }
+        if (!isAccepting(visited.back()))
+            return {};
+
+        std::vector<uint32_t> chains(word.size());
+        uint32_t state = *m_Accepting;
+        for (size_t i = word.size(); i-- > 0;) {
+            const auto& subset = m_Subsets[visited[i]];
+            for (const auto& transition : m_Reverse[state * m_Columns + m_Column[symbolIndex(word[i])]])
+                if (std::binary_search(subset.begin(), subset.end(), transition.m_State)) {
+                    chains[i] = transition.m_Chain;
+                    state = transition.m_State;
+                    break;
+                }
+        }
+
+        std::vector<size_t> result;
+        for (uint32_t chain : chains)
+            result.insert(result.end(), m_ChainRules.begin() + m_ChainOffsets[chain], m_ChainRules.begin() + m_ChainOffsets[chain + 1]);
+        return result;
+    }
+
+    /**
+     * @brief Turns a leftmost derivation of the reversed word in the mirrored grammar into the leftmost
+     * derivation of the word: the preorder is parsed into the tree (binary rules have two children) and
+     * the tree is written out again in preorder with the children of every node swapped.
+     */
+    std::vector<size_t> mirrorDerivation(const std::vector<size_t>& derivation) const {
+        std::vector<std::array<size_t, 2>> children(derivation.size());
+        std::vector<std::pair<size_t, size_t>> open; // binary nodes with the number of their children so far
+        for (size_t node = 0; node < derivation.size(); ++node) {
+            if (!open.empty()) {
+                auto& [parent, filled] = open.back();
+                children[parent][filled++] = node;
+                if (filled == 2)
+                    open.pop_back();
+            }
+            if (m_Binary[derivation[node]])
+                open.push_back({node, 0});
+        }
+
+        std::vector<size_t> result;
+        result.reserve(derivation.size());
+        std::vector<size_t> stack;
+        if (!derivation.empty())
+            stack.push_back(0);
+        while (!stack.empty()) {
+            size_t node = stack.back();
+            stack.pop_back();
+            result.push_back(derivation[node]);
+            if (m_Binary[derivation[node]]) {
+                stack.push_back(children[node][0]);
+                stack.push_back(children[node][1]);
+            }
+        }
+        return result;
+    }
+
+    bool isAccepting(int32_t state) const {
+        const auto& subset = m_Subsets[state];
+        return m_Accepting && std::binary_search(subset.begin(), subset.end(), *m_Accepting);
+    }
+
+    bool m_Mirrored = false;
+    std::vector<bool> m_Binary;
+    std::optional<size_t> m_EpsilonRule;
+    std::array<int, 256> m_Column;
+    size_t m_Columns = 0;
+    size_t m_NfaStates = 0;
+    std::optional<uint32_t> m_Accepting;
+    std::vector<size_t> m_ChainRules;
+    std::vector<size_t> m_ChainOffsets;
+    std::vector<std::vector<Transition>> m_Reverse;
+    std::vector<std::vector<uint32_t>> m_Subsets;
+    std::vector<int32_t> m_Next;
+};
+
+/**
+ * @brief Parsing algorithm used by Parser.
+ *
+ * Cyk always costs O(n^3 * |R|), Earley follows only rules predicted by the already read prefix and the
+ * next symbol, so it gets close to linear time on predictive (LL(1)-like) grammars. Automaton scans the
+ * word with a TraceAutomaton in O(n), which exists only for some grammars with regular languages.
+ * Auto chooses Automaton when it can be built, Earley for predictive grammars and CYK for all others,
+ * an Automaton which cannot be built falls back to CYK.
+ */
+enum class ParserEngine {
+    Auto,
+    Cyk,
+    Earley,
+    Automaton,
+};
+
+/**
+ * @brief Representation of the CYK chart.
+ *
+ * Backpointers stores the rule and the split of every recognised nonterminal (8 bytes per nonterminal
+ * and cell), so the trace is read off directly. Compact keeps a single bit per nonterminal and cell and
+ * recomputes the rule and the split of each node of the derivation when the trace is requested,
+ * dividing the word top-down. Auto takes Backpointers when it fits into the memory limit, Compact otherwise.
+ *
+ * Compact is a constant factor of 64 and nothing more: it keeps the whole chart, no sub-chart is dropped
+ * and recomputed, only the argmax of the derivation nodes is searched again. Every cell of CYK depends on
+ * its whole row and column, so recognition needs all of them and both charts stay quadratic in the length
+ * of the word: a word of 50 000 symbols over 4 nonterminals needs 625 MB in Compact (40 GB with
+ * Backpointers), with 16 nonterminals it is 2.5 GB. A word whose chart exceeds the memory limit of the
+ * parser is refused before anything is allocated, see Parser::setMemoryLimit(). Such words fit only for
+ * grammars with an Automaton, which needs O(n) memory.
+ */
+enum class ChartMode {
+    Auto,
+    Backpointers,
+    Compact,
+};
+
+/**
+ * @brief Wall clock time of the phases of a trace in seconds. Earley has no separate diagonal phase,
+ * all of its recognition is counted as the span fill.
+ */
+struct ParserPhaseTimes {
+    double m_Diagonal = 0;
+    double m_Spans = 0;
+    double m_Backtrack = 0;
+};
+
+/**
+ * @brief Instrumentation of the parser (timers and counters), compiled in only with PARSER_STATS defined,
+ * otherwise PARSER_STAT() drops its statement, so no clock is read and no statistic is written.
+ * test.sh builds and tests hw02 both with and without it.
+ */
+#ifdef PARSER_STATS
+#define PARSER_STAT(statement) statement
+#else
+#define PARSER_STAT(statement)
+#endif
+
+/**
+ * @brief Statistics of a single trace, see Parser::stats().
+ *
+ * Everything is collected only with PARSER_STATS defined, otherwise the statistics stay zero.
+ * For Earley a rule evaluation is an item looked at by a completion, a combination is a new completion.
+ */
+struct ParserStats {
+    ParserPhaseTimes m_Times;
+    size_t m_Length = 0;
+    uint64_t m_RuleEvaluations = 0;
+    uint64_t m_Combinations = 0;
+    /**
+     * @brief Number of recognised (nonterminal, substring) pairs by substring length, the fill density
+     * of span length len is m_FilledBySpan[len] / ((n - len + 1) * |N|).
+     */
+    std::vector<uint64_t> m_FilledBySpan;
+    uint64_t m_BacktrackSteps = 0;
+    /**
+     * @brief True when passesStaticFilters() rejected the word before any chart work.
+     */
+    bool m_Filtered = false;
+};
+
+/**
+ * @return Seconds since the given time point, which is moved to now.
+ */
+inline double lap(std::chrono::steady_clock::time_point& since) {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - since).count();
+    since = now;
+    return seconds;
+}
+
+/**
+ * @brief Parser over a compiled grammar, which keeps its chart buffers between calls.
+ *
+ * The chart is a single contiguous vector, cell for substring <start, end> holds one Backpointer per
+ * nonterminal, which is recorded while the chart is filled. Cells are stored column by column,
+ * so a word of length n uses the first n * (n + 1) / 2 * |N| entries and the buffer only grows when a
+ * longer word than any before comes. Batch tracing gives every worker thread its own buffers.
+ *
+ * In ChartMode::Compact the chart holds bitsets instead, see parseCompact(). The Earley engine keeps one
+ * set per position of the word, see parseEarley(), chart mode and memory limit apply to CYK only.
+ * accepts() only recognizes the word, CYK then always fills the compact chart and no engine extracts a derivation.
+ */
+class Parser {
+public:
+    static constexpr size_t DEFAULT_MEMORY_LIMIT = size_t(1) << 30;
+
+    explicit Parser(const Grammar& grammar, ParserEngine engine = ParserEngine::Auto)
+        : Parser(compileGrammar(grammar), engine) {}
+
+    explicit Parser(std::shared_ptr<const CompiledGrammar> grammar, ParserEngine engine = ParserEngine::Auto)
+        : m_Grammar(std::move(grammar)), m_Engine(engine), m_Workspaces(1) {
+        if (m_Engine == ParserEngine::Auto || m_Engine == ParserEngine::Automaton) {
+            m_Automaton = TraceAutomaton::build(*m_Grammar);
+            if (m_Automaton)
+                m_Engine = ParserEngine::Automaton;
+            else if (m_Engine == ParserEngine::Automaton)
+                m_Engine = ParserEngine::Cyk;
+        }
+        if (m_Engine == ParserEngine::Auto)
+            m_Engine = m_Grammar->m_Predictive ? ParserEngine::Earley : ParserEngine::Cyk;
+    }
+
+    /**
+     * @brief Parser sharing an automaton built before, see TraceAutomaton::build(). Without one the parser
+     * falls back to the engine ParserEngine::Auto would choose for a grammar that has no automaton.
+     */
+    Parser(std::shared_ptr<const CompiledGrammar> grammar, std::shared_ptr<const TraceAutomaton> automaton)
+        : m_Grammar(std::move(grammar)), m_Automaton(std::move(automaton)), m_Workspaces(1) {
+        if (m_Automaton)
+            m_Engine = ParserEngine::Automaton;
+        else
+            m_Engine = m_Grammar->m_Predictive ? ParserEngine::Earley : ParserEngine::Cyk;
+    }
+
+    const CompiledGrammar& grammar() const {
+        return *m_Grammar;
+    }
+
+    /**
+     * @return The engine used for parsing, never ParserEngine::Auto.
+     */
+    ParserEngine engine() const {
+        return m_Engine;
+    }
+
+    ChartMode chartMode() const {
+        return m_ChartMode;
+    }
+
+    void setChartMode(ChartMode mode) {
+        m_ChartMode = mode;
+    }
+
+    size_t memoryLimit() const {
+        return m_MemoryLimit;
+    }
+
+    /**
+     * @brief Sets the ceiling for the chart of a single word in bytes, DEFAULT_MEMORY_LIMIT until set.
+     * A word whose chart does not fit (in ChartMode::Auto not even the compact one) is refused with
+     * std::length_error before the chart is allocated, SIZE_MAX lifts the ceiling.
+     */
+    void setMemoryLimit(size_t bytes) {
+        m_MemoryLimit = bytes;
+    }
+
+    /**
+     * @return Size of the CYK chart for a word of the given length in bytes.
+     */
+    size_t chartBytes(size_t length, ChartMode mode) const {
+        size_t cells = length * (length + 1) / 2;
+        if (mode == ChartMode::Compact)
+            return compactWords(length) * sizeof(uint64_t);
+        return cells * m_Grammar->m_NonterminalCount * sizeof(Backpointer);
+    }
+
+    /**
+     * @brief Chart mode used for a word of the given length.
+     *
+     * @throws std::length_error When the chart does not fit into the memory limit.
+     */
+    ChartMode chartModeFor(size_t length) const {
+        ChartMode mode = m_ChartMode;
+        if (mode == ChartMode::Auto)
+            mode = chartBytes(length, ChartMode::Backpointers) <= m_MemoryLimit ? ChartMode::Backpointers : ChartMode::Compact;
+        if (chartBytes(length, mode) > m_MemoryLimit)
+            throw std::length_error("CYK chart exceeds the memory limit");
+        return mode;
+    }
+
+    /**
+     * @return Leftmost derivation of the word as indices of rules, empty if the word is not in the language.
+     *
+     * @throws std::length_error When the CYK chart of the word does not fit into the memory limit.
+     */
+    std::vector<size_t> trace(const Word& word) {
+        return traceWith(m_Workspaces[0], word, true);
+    }
+
+    /**
+     * @brief Same as trace() for a non-empty word which the caller already checked by passesStaticFilters(),
+     * the filters are not run again.
+     */
+    std::vector<size_t> traceFiltered(const Word& word) {
+        return traceWith(m_Workspaces[0], word, false);
+    }
+
+    /**
+     * @brief Membership of the word without a derivation, see Parser.
+     *
+     * @throws std::length_error When the compact CYK chart of the word does not fit into the memory limit.
+     */
+    bool accepts(const Word& word) {
+        return parseWith(m_Workspaces[0], word, true, nullptr);
+    }
+
+    /**
+     * @brief Builds the shared packed parse forest of all derivations of the word.
+     */
+    ParseForest forest(const Word& word) const {
+        return ParseForest::build(*m_Grammar, word);
+    }
+
+    /**
+     * @return Phase times of the last call of trace(), measured only with PARSER_STATS.
+     */
+    const ParserPhaseTimes& phaseTimes() const {
+        return m_Workspaces[0].m_Stats.m_Times;
+    }
+
+    /**
+     * @return Statistics of the last call of trace().
+     */
+    const ParserStats& stats() const {
+        return m_Workspaces[0].m_Stats;
+    }
+
+    /**
+     * @brief Bytes held by the buffers of trace(), which keep the size of the largest word traced so far.
+     * The hash set of the Earley engine is estimated from its buckets and elements.
+     */
+    size_t workspaceBytes() const {
+        const Workspace& workspace = m_Workspaces[0];
+        size_t bytes = workspace.m_Chart.capacity() * sizeof(Backpointer) + workspace.m_Bits.capacity() * sizeof(uint64_t) +
+                       workspace.m_Sets.capacity() * sizeof(EarleySet) + workspace.m_Sorted.capacity() * sizeof(EarleyItem) +
+                       workspace.m_Next.capacity() * sizeof(uint32_t) +
+                       (workspace.m_Predicted.capacity() + workspace.m_Pending.capacity() + workspace.m_Agenda.capacity()) * sizeof(size_t) +
+                       workspace.m_Seen.bucket_count() * sizeof(void*) + workspace.m_Seen.size() * (sizeof(uint64_t) + sizeof(void*));
+        for (const auto& set : workspace.m_Sets)
+            bytes += set.m_Items.capacity() * sizeof(EarleyItem) + set.m_Offsets.capacity() * sizeof(uint32_t) +
+                     set.m_Completed.capacity() * sizeof(EarleyCompletion);
+        return bytes;
+    }
+
+    /**
+     * @brief Sets a callback which receives the statistics after every traced word, traceBatch() calls it
+     * from its worker threads concurrently.
+     */
+    void setStatsCallback(std::function<void(const ParserStats&)> callback) {
+        m_StatsCallback = std::move(callback);
+    }
+
+    /**
+     * @brief Traces all words, spreading them across threadCount threads (0 means all hardware threads).
+     *
+     * @return One trace per word, in the order of the words.
+     */
+    std::vector<std::vector<size_t>> traceBatch(const std::vector<Word>& words, size_t threadCount = 0) {
+        std::vector<std::vector<size_t>> traces(words.size());
+        if (threadCount == 0)
+            threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+        if (m_Workspaces.size() < threadCount)
+            m_Workspaces.resize(threadCount);
+
+        parallelFor(words.size(), threadCount, [&](size_t index, size_t worker) {
+            traces[index] = traceWith(m_Workspaces[worker], words[index], true);
+        });
+        return traces;
+    }
+
+private:
+    /**
+     * @brief Earley item of a binary rule, either waiting for its left nonterminal (not advanced, origin is
+     * the set it lives in) or for its right one (advanced, the left one ended at the set it lives in).
+     */
+    struct EarleyItem {
+        uint32_t m_Rule;
+        uint32_t m_Origin;
+        bool m_Advanced;
+    };
+
+    /**
+     * @brief Nonterminal which generates the word from origin to the set it is stored in.
+     */
+    struct EarleyCompletion {
+        uint32_t m_Nonterminal;
+        uint32_t m_Origin;
+        Backpointer m_Backpointer;
+
+        bool operator<(const EarleyCompletion& other) const {
+            return std::tie(m_Nonterminal, m_Origin) < std::tie(other.m_Nonterminal, other.m_Origin);
+        }
+    };
+
+    /**
+     * @brief Items of a finished set are sorted by the nonterminal they wait for,
+     * m_Offsets[A] .. m_Offsets[A + 1] is the range waiting for A.
+     */
+    struct EarleySet {
+        std::vector<EarleyItem> m_Items;
+        std::vector<uint32_t> m_Offsets;
+        std::vector<EarleyCompletion> m_Completed;
+    };
+
+    struct Workspace {
+        std::vector<Backpointer> m_Chart;
+        std::vector<uint64_t> m_Bits;
+        std::vector<EarleySet> m_Sets;
+        std::vector<EarleyItem> m_Sorted;
+        std::vector<uint32_t> m_Next;
+        std::vector<size_t> m_Predicted;
+        std::vector<size_t> m_Pending;
+        std::vector<size_t> m_Agenda;
+        std::unordered_set<uint64_t> m_Seen;
+        ParserStats m_Stats;
+    };
+
+    std::vector<size_t> traceWith(Workspace& workspace, const Word& word, bool filter) const {
+        std::vector<size_t> result;
+        parseWith(workspace, word, filter, &result);
+        return result;
+    }
+
+    /**
+     * @return True if the word is in the language, its derivation is stored only when derivation is not nullptr.
+     */
+    bool parseWith(Workspace& workspace, const Word& word, bool filter, std::vector<size_t>* derivation) const {
+        const CompiledGrammar& grammar = *m_Grammar;
+        ParserStats& stats = workspace.m_Stats;
+        PARSER_STAT(stats = ParserStats());
+        PARSER_STAT(stats.m_Length = word.size());
+        PARSER_STAT(stats.m_RuleEvaluations = stats.m_Combinations = stats.m_BacktrackSteps = 0);
+        PARSER_STAT(stats.m_FilledBySpan.assign(word.size() + 1, 0));
+
+        bool accepted = false;
+        if (word.empty()) {
+            accepted = grammar.m_EpsilonRule.has_value();
+            if (accepted && derivation)
+                *derivation = {*grammar.m_EpsilonRule};
+        }
+        else if (filter && !passesStaticFilters(grammar, word)) {
+            PARSER_STAT(stats.m_Filtered = true);
+        }
+        else if (m_Engine == ParserEngine::Automaton) {
+            PARSER_STAT(auto clock = std::chrono::steady_clock::now());
+            if (derivation)
+                accepted = !(*derivation = m_Automaton->trace(word)).empty();
+            else
+                accepted = m_Automaton->accepts(word);
+            PARSER_STAT(stats.m_Times.m_Spans = lap(clock));
+        }
+        else if (m_Engine == ParserEngine::Earley)
+            accepted = parseEarley(workspace, word, derivation);
+        else if (!derivation) {
+            if (chartBytes(word.size(), ChartMode::Compact) > m_MemoryLimit)
+                throw std::length_error("CYK chart exceeds the memory limit");
+            accepted = parseCompact(workspace, word, nullptr);
+        }
+        else if (chartModeFor(word.size()) == ChartMode::Compact)
+            accepted = parseCompact(workspace, word, derivation);
+        else
+            accepted = parseCyk(workspace, word, derivation);
+
+        PARSER_STAT(stats.m_BacktrackSteps = derivation ? derivation->size() : 0);
+        if (m_StatsCallback)
+            m_StatsCallback(stats);
+        return accepted;
+    }
+
+    void countFilled(ParserStats& stats, size_t len, const Backpointer* cell) const {
+        for (size_t nonTerminal = 0; nonTerminal < m_Grammar->m_NonterminalCount; ++nonTerminal)
+            stats.m_FilledBySpan[len] += cell[nonTerminal].m_Rule != -1;
+    }
+
+    void countFilled(ParserStats& stats, size_t len, const uint64_t* chart, size_t cell) const {
+        for (size_t bit = cell; bit < cell + m_Grammar->m_NonterminalCount; ++bit)
+            stats.m_FilledBySpan[len] += (chart[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    /**
+     * @return Number of 64-bit words of the compact chart of a word of the given length.
+     */
+    size_t compactWords(size_t length) const {
+        return (length * (length + 1) / 2 * m_Grammar->m_NonterminalCount + 63) / 64;
+    }
+
+    bool parseCyk(Workspace& workspace, const Word& word, std::vector<size_t>* derivation) const {
+        const CompiledGrammar& grammar = *m_Grammar;
+        size_t n = word.size();
+        size_t width = grammar.m_NonterminalCount;
+        size_t chartSize = n * (n + 1) / 2 * width;
+        if (workspace.m_Chart.size() < chartSize)
+            workspace.m_Chart.resize(chartSize);
+        PARSER_STAT(auto clock = std::chrono::steady_clock::now());
+        std::fill_n(workspace.m_Chart.begin(), chartSize, Backpointer());
+        Backpointer* chart = workspace.m_Chart.data();
+
+        /**
+         * @brief Fills in the diagonal of the chart, each terminal rule of the current symbol
+         * marks its nonterminal in the one symbol long substring.
+         */
+        for (size_t charIndex = 0; charIndex < n; ++charIndex) {
+            Backpointer* cell = chart + cellIndex(charIndex, charIndex) * width;
+            for (const auto& rule : grammar.m_TerminalRules[symbolIndex(word[charIndex])])
+                cell[rule.m_Nonterminal].m_Rule = rule.m_Rule;
+            PARSER_STAT(countFilled(workspace.m_Stats, 1, cell));
+        }
+        PARSER_STAT(workspace.m_Stats.m_Times.m_Diagonal = lap(clock));
+
+        /**
+         * @brief Fills in the chart for all substrings of length 2 or more, a binary rule marks its
+         * nonterminal when both of its right side nonterminals generate the two parts at some split.
+         * The rule and the split are remembered, so backtracking never has to search for them again.
+         */
+        for (size_t len = 2; len <= n; ++len)
+            for (size_t startPos = 0; startPos <= n - len; ++startPos) {
+                size_t endPos = startPos + len - 1;
+                Backpointer* cell = chart + cellIndex(startPos, endPos) * width;
+                for (size_t splitPos = startPos; splitPos < endPos; ++splitPos) {
+                    const Backpointer* left = chart + cellIndex(startPos, splitPos) * width;
+                    const Backpointer* right = chart + cellIndex(splitPos + 1, endPos) * width;
+                    PARSER_STAT(workspace.m_Stats.m_RuleEvaluations += grammar.m_BinaryRules.size());
+                    for (const auto& rule : grammar.m_BinaryRules)
+                        if (left[rule.m_Left].m_Rule != -1 && right[rule.m_Right].m_Rule != -1) {
+                            cell[rule.m_Nonterminal] = {static_cast<int>(rule.m_Rule), static_cast<int>(splitPos)};
+                            PARSER_STAT(++workspace.m_Stats.m_Combinations);
+                        }
+                }
+                PARSER_STAT(countFilled(workspace.m_Stats, len, cell));
+            }
+        PARSER_STAT(workspace.m_Stats.m_Times.m_Spans = lap(clock));
+
+        if (chart[cellIndex(0, n - 1) * width + grammar.m_InitialSymbol].m_Rule == -1)
+            return false;
+        if (derivation) {
+            *derivation = extractDerivation(grammar, 0, n - 1, [&](size_t nonTerminal, size_t i, size_t j) {
+                return chart[cellIndex(i, j) * width + nonTerminal];
+            });
+            PARSER_STAT(workspace.m_Stats.m_Times.m_Backtrack = lap(clock));
+        }
+        return true;
+    }
+
+    /**
+     * @brief CYK with a chart of bitsets, every cell only says which nonterminals generate the substring.
+     *
+     * Nothing but the bits is kept, so when the word is accepted the derivation is recomputed top-down:
+     * for every node the rules of its nonterminal are tried at every split until both halves are marked
+     * in the chart and the search continues in the two halves. This costs O(n * |R|) per node instead
+     * of a lookup, in exchange the chart is 64 times smaller than with backpointers: the bits of all cells
+     * are packed one after another, cell <start, end> takes bits from cellIndex(start, end) * |N| on,
+     * so no cell pads its nonterminals to a whole word.
+     */
+    bool parseCompact(Workspace& workspace, const Word& word, std::vector<size_t>* derivation) const {
+        const CompiledGrammar& grammar = *m_Grammar;
+        size_t n = word.size();
+        size_t width = grammar.m_NonterminalCount;
+        size_t chartSize = compactWords(n);
+        if (workspace.m_Bits.size() < chartSize)
+            workspace.m_Bits.resize(chartSize);
+        PARSER_STAT(auto clock = std::chrono::steady_clock::now());
+        std::fill_n(workspace.m_Bits.begin(), chartSize, 0);
+        uint64_t* chart = workspace.m_Bits.data();
+
+        // cells are addressed by their first bit, see cellIndex()
+        auto test = [&](size_t cell, size_t nonTerminal) {
+            size_t bit = cell + nonTerminal;
+            return (chart[bit / 64] >> (bit % 64)) & 1;
+        };
+        auto mark = [&](size_t cell, size_t nonTerminal) {
+            size_t bit = cell + nonTerminal;
+            chart[bit / 64] |= uint64_t(1) << (bit % 64);
+        };
+
+        for (size_t charIndex = 0; charIndex < n; ++charIndex) {
+            size_t cell = cellIndex(charIndex, charIndex) * width;
+            for (const auto& rule : grammar.m_TerminalRules[symbolIndex(word[charIndex])])
+                mark(cell, rule.m_Nonterminal);
+            PARSER_STAT(countFilled(workspace.m_Stats, 1, chart, cell));
+        }
+        PARSER_STAT(workspace.m_Stats.m_Times.m_Diagonal = lap(clock));
+
+        for (size_t len = 2; len <= n; ++len)
+            for (size_t startPos = 0; startPos <= n - len; ++startPos) {
+                size_t endPos = startPos + len - 1;
+                size_t cell = cellIndex(startPos, endPos) * width;
+                for (size_t splitPos = startPos; splitPos < endPos; ++splitPos) {
+                    size_t left = cellIndex(startPos, splitPos) * width;
+                    size_t right = cellIndex(splitPos + 1, endPos) * width;
+                    PARSER_STAT(workspace.m_Stats.m_RuleEvaluations += grammar.m_BinaryRules.size());
+                    for (const auto& rule : grammar.m_BinaryRules)
+                        if (test(left, rule.m_Left) && test(right, rule.m_Right)) {
+                            mark(cell, rule.m_Nonterminal);
+                            PARSER_STAT(++workspace.m_Stats.m_Combinations);
+                        }
+                }
+                PARSER_STAT(countFilled(workspace.m_Stats, len, chart, cell));
+            }
+        PARSER_STAT(workspace.m_Stats.m_Times.m_Spans = lap(clock));
+
+        if (!test(cellIndex(0, n - 1) * width, grammar.m_InitialSymbol))
+            return false;
+        if (!derivation)
+            return true;
+        *derivation = extractDerivation(grammar, 0, n - 1, [&](size_t nonTerminal, size_t i, size_t j) {
+            if (i == j) {
+                for (const auto& rule : grammar.m_TerminalRules[symbolIndex(word[i])])
+                    if (rule.m_Nonterminal == nonTerminal)
+                        return Backpointer{static_cast<int>(rule.m_Rule), -1};
+            }
+            else
+                for (size_t ruleIndex : grammar.m_BinaryRulesOf[nonTerminal]) {
+                    const auto& rule = grammar.m_BinaryRules[ruleIndex];
+                    for (size_t k = i; k < j; ++k)
+                        if (test(cellIndex(i, k) * width, rule.m_Left) && test(cellIndex(k + 1, j) * width, rule.m_Right))
+                            return Backpointer{static_cast<int>(rule.m_Rule), static_cast<int>(k)};
+                }
+            return Backpointer();
+        });
+        PARSER_STAT(workspace.m_Stats.m_Times.m_Backtrack = lap(clock));
+        return true;
+    }
+
+    /**
+     * @brief Earley parser specialised for the normal form of the grammar.
+     *
+     * Set j describes the state after reading j symbols. A nonterminal is predicted in set j only when the
+     * next symbol is in its FIRST set, its terminal rules are scanned straight into set j + 1 as completions
+     * and its binary rules become items waiting for the left nonterminal. A completion of B from k to j
+     * advances the items of set k waiting for B. No nonterminal derives the empty word inside a derivation
+     * of a non-empty word, so k < j and set k is already finished and sorted when it is looked up.
+     * Completions keep the rule and the split that created them first, which are later read as backpointers.
+     */
+    bool parseEarley(Workspace& workspace, const Word& word, std::vector<size_t>* derivation) const {
+        const CompiledGrammar& grammar = *m_Grammar;
+        size_t n = word.size();
+        size_t width = grammar.m_NonterminalCount;
+        PARSER_STAT(auto clock = std::chrono::steady_clock::now());
+
+        if (workspace.m_Sets.size() < n + 1)
+            workspace.m_Sets.resize(n + 1);
+        for (size_t j = 0; j <= n; ++j) {
+            workspace.m_Sets[j].m_Items.clear();
+            workspace.m_Sets[j].m_Completed.clear();
+        }
+        workspace.m_Predicted.assign(width, SIZE_MAX);
+        auto& sets = workspace.m_Sets;
+        auto& agenda = workspace.m_Agenda;
+        auto& seen = workspace.m_Seen;
+
+        auto complete = [&](size_t j, size_t nonTerminal, size_t origin, Backpointer backpointer) {
+            if (seen.insert(uint64_t(nonTerminal) << 32 | origin | uint64_t(1) << 63).second) {
+                sets[j].m_Completed.push_back({uint32_t(nonTerminal), uint32_t(origin), backpointer});
+                agenda.push_back(sets[j].m_Completed.size() - 1);
+                PARSER_STAT(++workspace.m_Stats.m_Combinations);
+                PARSER_STAT(++workspace.m_Stats.m_FilledBySpan[j - origin]);
+            }
+        };
+
+        auto& pending = workspace.m_Pending;
+        auto predict = [&](size_t j, size_t nonTerminal) {
+            auto isUseful = [&](size_t candidate) {
+                return workspace.m_Predicted[candidate] != j && grammar.m_First[candidate][symbolIndex(word[j])];
+            };
+            if (!isUseful(nonTerminal))
+                return;
+            workspace.m_Predicted[nonTerminal] = j;
+            pending.assign(1, nonTerminal);
+            while (!pending.empty()) {
+                size_t current = pending.back();
+                pending.pop_back();
+                for (size_t rule : grammar.m_BinaryRulesOf[current]) {
+                    sets[j].m_Items.push_back({uint32_t(rule), uint32_t(j), false});
+                    size_t left = grammar.m_BinaryRules[rule].m_Left;
+                    if (isUseful(left)) {
+                        workspace.m_Predicted[left] = j;
+                        pending.push_back(left);
+                    }
+                }
+            }
+        };
+
+        predict(0, grammar.m_InitialSymbol);
+        for (size_t j = 0; j <= n; ++j) {
+            EarleySet& set = sets[j];
+            if (j > 0)
+                while (!agenda.empty()) {
+                    EarleyCompletion completion = set.m_Completed[agenda.back()];
+                    agenda.pop_back();
+                    const EarleySet& origin = sets[completion.m_Origin];
+                    PARSER_STAT(workspace.m_Stats.m_RuleEvaluations += origin.m_Offsets[completion.m_Nonterminal + 1] - origin.m_Offsets[completion.m_Nonterminal]);
+                    for (uint32_t i = origin.m_Offsets[completion.m_Nonterminal]; i < origin.m_Offsets[completion.m_Nonterminal + 1]; ++i) {
+                        const EarleyItem& item = origin.m_Items[i];
+                        const auto& rule = grammar.m_BinaryRules[item.m_Rule];
+                        if (item.m_Advanced)
+                            complete(j, rule.m_Nonterminal, item.m_Origin, {int(rule.m_Rule), int(completion.m_Origin) - 1});
+                        else if (j < n && grammar.m_First[rule.m_Right][symbolIndex(word[j])] &&
+                                 seen.insert(uint64_t(item.m_Rule) << 32 | item.m_Origin).second) {
+                            set.m_Items.push_back({item.m_Rule, item.m_Origin, true});
+                            predict(j, rule.m_Right);
+                        }
+                    }
+                }
+            seen.clear();
+            if (j == n)
+                break;
+
+            for (const auto& rule : grammar.m_TerminalRules[symbolIndex(word[j])])
+                if (workspace.m_Predicted[rule.m_Nonterminal] == j)
+                    complete(j + 1, rule.m_Nonterminal, j, {int(rule.m_Rule), -1});
+
+            /**
+             * @brief Counting sort of the finished set by the nonterminal its items wait for.
+             */
+            set.m_Offsets.assign(width + 1, 0);
+            auto waitsFor = [&](const EarleyItem& item) {
+                const auto& rule = grammar.m_BinaryRules[item.m_Rule];
+                return item.m_Advanced ? rule.m_Right : rule.m_Left;
+            };
+            for (const auto& item : set.m_Items)
+                ++set.m_Offsets[waitsFor(item) + 1];
+            std::partial_sum(set.m_Offsets.begin(), set.m_Offsets.end(), set.m_Offsets.begin());
+            workspace.m_Sorted.resize(set.m_Items.size());
+            auto& next = workspace.m_Next;
+            next.assign(set.m_Offsets.begin(), set.m_Offsets.end() - 1);
+            for (const auto& item : set.m_Items)
+                workspace.m_Sorted[next[waitsFor(item)]++] = item;
+            set.m_Items.swap(workspace.m_Sorted);
+        }
+
+        for (size_t j = 1; j <= n; ++j)
+            std::sort(sets[j].m_Completed.begin(), sets[j].m_Completed.end());
+        auto lookup = [&](size_t nonTerminal, size_t i, size_t j) {
+            const auto& completed = sets[j + 1].m_Completed;
+            auto it = std::lower_bound(completed.begin(), completed.end(), EarleyCompletion{uint32_t(nonTerminal), uint32_t(i), {}});
+            if (it == completed.end() || it->m_Nonterminal != nonTerminal || it->m_Origin != i)
+                return Backpointer();
+            return it->m_Backpointer;
+        };
+        PARSER_STAT(workspace.m_Stats.m_Times.m_Spans = lap(clock));
+        if (lookup(grammar.m_InitialSymbol, 0, n - 1).m_Rule == -1)
+            return false;
+        if (derivation) {
+            *derivation = extractDerivation(grammar, 0, n - 1, lookup);
+            PARSER_STAT(workspace.m_Stats.m_Times.m_Backtrack = lap(clock));
+        }
+        return true;
+    }
+
+    std::shared_ptr<const CompiledGrammar> m_Grammar;
+    ParserEngine m_Engine;
+    std::shared_ptr<const TraceAutomaton> m_Automaton;
+    ChartMode m_ChartMode = ChartMode::Auto;
+    size_t m_MemoryLimit = DEFAULT_MEMORY_LIMIT;
+    std::function<void(const ParserStats&)> m_StatsCallback;
+    std::vector<Workspace> m_Workspaces;
+};
+
+std::vector<size_t> trace(const Grammar& grammar, const Word& word) {
+    // the automaton is built for the single word only, it pays off over the cubic chart just for long words
+    constexpr size_t automatonLength = 512;
+    auto compiled = compileGrammar(grammar);
+    if (word.size() >= automatonLength)
+        return Parser(compiled).trace(word);
+    return Parser(compiled, std::shared_ptr<const TraceAutomaton>()).trace(word);
+}
+
+/**
+ * @brief Incremental CYK parser of a word which arrives symbol by symbol.
+ *
+ * Appending a symbol computes only the new chart column, i.e. all substrings ending at the new position,
+ * from the shortest to the longest. Every cell of the column combines cells of older columns with
+ * shorter cells of the same column, which are already finished. A push therefore costs O(n^2 * |R|)
+ * instead of the O(n^3 * |R|) of parsing the whole prefix again.
+ */
+class ParserSession {
+public:
+    explicit ParserSession(const Grammar& grammar)
+        : ParserSession(compileGrammar(grammar)) {}
+
+    explicit ParserSession(std::shared_ptr<const CompiledGrammar> grammar)
+        : m_Grammar(std::move(grammar)) {}
+
+    /**
+     * @brief Appends a symbol to the current prefix.
+     */
+    void push(Symbol symbol) {
+        const CompiledGrammar& grammar = *m_Grammar;
+        size_t width = grammar.m_NonterminalCount;
+        size_t endPos = m_Length++;
+        m_Chart.resize(cellIndex(0, m_Length) * width);
+
+        Backpointer* chart = m_Chart.data();
+        Backpointer* diagonal = chart + cellIndex(endPos, endPos) * width;
+        for (const auto& rule : grammar.m_TerminalRules[symbolIndex(symbol)])
+            diagonal[rule.m_Nonterminal].m_Rule = rule.m_Rule;
+
+        for (size_t startPos = endPos; startPos-- > 0;) {
+            Backpointer* cell = chart + cellIndex(startPos, endPos) * width;
+            for (size_t splitPos = startPos; splitPos < endPos; ++splitPos) {
+                const Backpointer* left = chart + cellIndex(startPos, splitPos) * width;
+                const Backpointer* right = chart + cellIndex(splitPos + 1, endPos) * width;
+                for (const auto& rule : grammar.m_BinaryRules)
+                    if (left[rule.m_Left].m_Rule != -1 && right[rule.m_Right].m_Rule != -1)
+                        cell[rule.m_Nonterminal] = {static_cast<int>(rule.m_Rule), static_cast<int>(splitPos)};
+            }
+        }
+    }
+
+    /**
+     * @brief Forgets the prefix, keeps the chart buffer.
+     */
+    void clear() {
+        m_Chart.clear();
+        m_Length = 0;
+    }
+
+    size_t size() const {
+        return m_Length;
+    }
+
+    /**
+     * @return True if the current prefix is in the language.
+     */
+    bool accepts() const {
+        if (m_Length == 0)
+            return m_Grammar->m_EpsilonRule.has_value();
+        return at(m_Grammar->m_InitialSymbol, 0, m_Length - 1).m_Rule != -1;
+    }
+
+    /**
+     * @return Leftmost derivation of the current prefix, empty if the prefix is not in the language.
+     */
+    std::vector<size_t> trace() const {
+        if (!accepts())
+            return {};
+        if (m_Length == 0)
+            return {*m_Grammar->m_EpsilonRule};
+        return extractDerivation(*m_Grammar, 0, m_Length - 1, [&](size_t nonTerminal, size_t i, size_t j) {
+            return at(nonTerminal, i, j);
+        });
+    }
+
+private:
+    const Backpointer& at(size_t nonTerminal, size_t start, size_t end) const {
+        return m_Chart[cellIndex(start, end) * m_Grammar->m_NonterminalCount + nonTerminal];
+    }
+
+    std::shared_ptr<const CompiledGrammar> m_Grammar;
+    std::vector<Backpointer> m_Chart;
+    size_t m_Length = 0;
+};
+
+/**
+ * @brief Grammar which accepted a word in Classifier::classify() and the trace of the word.
+ */
+struct Classification {
+    size_t m_Grammar;
+    std::vector<size_t> m_Trace;
+};
+
+/**
+ * @brief Decides which of many grammars accept a word.
+ *
+ * Every grammar is compiled once and gets its own Parser. The terminal rules of all grammars are indexed
+ * together by their terminal, so a single pass over the word finds the grammars which have a terminal rule
+ * for each of its symbols, one bitwise AND over all grammars per distinct symbol. Only those grammars are
+ * checked by passesStaticFilters() against the features of the word, computed once per classify(), and parsed
+ * without filtering again, in parallel.
+ */
+class Classifier {
+public:
+    explicit Classifier(const std::vector<Grammar>& grammars, ParserEngine engine = ParserEngine::Auto) {
+        for (const auto& grammar : grammars)
+            m_Parsers.emplace_back(compileGrammar(grammar), engine);
+        buildIndex();
+    }
+
+    explicit Classifier(const std::vector<std::shared_ptr<const CompiledGrammar>>& grammars, ParserEngine engine = ParserEngine::Auto) {
+        for (const auto& grammar : grammars)
+            m_Parsers.emplace_back(grammar, engine);
+        buildIndex();
+    }
+
+    size_t size() const {
+        return m_Parsers.size();
+    }
+
+    /**
+     * @brief Finds grammars which accept the word, using up to threadCount threads (0 means all hardware threads).
+     *
+     * With firstMatchOnly only the accepting grammar with the lowest index is returned. Grammars are started in
+     * the order of their indices and no grammar after an accepting one is started, so all grammars before the
+     * returned one were parsed and rejected the word, the result does not depend on the timing of the threads.
+     *
+     * @return Accepting grammars ordered by their index, each with the trace of the word.
+     */
+    std::vector<Classification> classify(const Word& word, bool firstMatchOnly = false, size_t threadCount = 0) {
+        WordFeatures features = wordFeatures(word);
+        std::vector<size_t> candidates = candidatesFor(features);
+        std::vector<std::vector<size_t>> traces(m_Parsers.size());
+        std::atomic<size_t> firstMatch{SIZE_MAX};
+        parallelFor(candidates.size(), threadCount, [&](size_t position, size_t) {
+            size_t index = candidates[position];
+            if (firstMatchOnly && index > firstMatch)
+                return;
+            if (word.empty())
+                traces[index] = m_Parsers[index].trace(word);
+            else if (passesStaticFilters(m_Parsers[index].grammar(), features))
+                traces[index] = m_Parsers[index].traceFiltered(word);
+            if (traces[index].empty())
+                return;
+            for (size_t current = firstMatch; index < current && !firstMatch.compare_exchange_weak(current, index);)
+                ;
+        });
 
-struct Grammar {
-    std::set<Symbol> m_Nonterminals;
-    std::set<Symbol> m_Terminals;
-    std::vector<std::pair<Symbol, std::vector<Symbol>>> m_Rules;
-    Symbol m_InitialSymbol;
+        std::vector<Classification> result;
+        for (size_t index = 0; index < traces.size(); ++index)
+            if (!traces[index].empty()) {
+                result.push_back({index, std::move(traces[index])});
+                if (firstMatchOnly)
+                    break;
+            }
+        return result;
+    }
+
+private:
+    /**
+     * @brief Fills in m_WithTerminal, bit g of m_WithTerminal[a] says that grammar g has a terminal rule for a.
+     */
+    void buildIndex() {
+        m_Blocks = (m_Parsers.size() + 63) / 64;
+        for (auto& grammars : m_WithTerminal)
+            grammars.assign(m_Blocks, 0);
+        for (size_t index = 0; index < m_Parsers.size(); ++index)
+            for (size_t terminal = 0; terminal < 256; ++terminal)
+                if (m_Parsers[index].grammar().m_Alphabet[terminal])
+                    m_WithTerminal[terminal][index / 64] |= uint64_t(1) << (index % 64);
+    }
+
+    /**
+     * @return Indices of the grammars with a terminal rule for every symbol of the word, in increasing order.
+     */
+    std::vector<size_t> candidatesFor(const WordFeatures& features) const {
+        std::vector<uint64_t> grammars(m_Blocks, ~uint64_t(0));
+        for (size_t terminal = 0; terminal < 256; ++terminal)
+            if (features.m_Symbols[terminal])
+                for (size_t block = 0; block < m_Blocks; ++block)
+                    grammars[block] &= m_WithTerminal[terminal][block];
+
+        std::vector<size_t> candidates;
+        for (size_t index = 0; index < m_Parsers.size(); ++index)
+            if ((grammars[index / 64] >> (index % 64)) & 1)
+                candidates.push_back(index);
+        return candidates;
+    }
+
+    std::vector<Parser> m_Parsers;
+    size_t m_Blocks = 0;
+    std::array<std::vector<uint64_t>, 256> m_WithTerminal;
 };
 
 /**
- * @brief Reconstructs the word from a given sequence of rule indices.
- * 
- * The function creates a lambda function that applies a rule from the grammar.
- * If the rule derives a terminal symbol, the function adds this symbol to the word.
- * If the rule derives a nonterminal symbol, the function recursively calls itself with the next rule in the sequence.
- * After defining the lambda function, the function iterates over the sequence of rule indices and applies each rule using the lambda function.
- * 
- * @param grammar The context-free grammar used for parsing.
- * @param trace A sequence of indices of rules in the grammar that can derive the word.
- * @return The word derived from the sequence of rule indices.
+ * @brief Most probable derivation of a word, see WeightedParser. An empty trace with log-probability
+ * -inf means the word is not in the language.
  */
-Word reconstructWord(const Grammar& grammar, std::vector<size_t> trace) {
-    Word word;
-    std::function<void(size_t)> applyRule = [&](size_t ruleIndex) mutable {
-        const auto& rule = grammar.m_Rules[ruleIndex];
-        for (const auto& symbol : rule.second) {
-            if (grammar.m_Terminals.count(symbol))
-                word.push_back(symbol);
-            else 
-                if (!trace.empty()) {
-                    size_t nextRuleIndex = trace.front();
-                    trace.erase(trace.begin());
-                    applyRule(nextRuleIndex);
+struct WeightedTrace {
+    std::vector<size_t> m_Trace;
+    double m_LogProbability = -INFINITY;
+};
+
+/**
+ * @brief Viterbi CYK over a grammar whose rules carry log-probabilities.
+ *
+ * The chart holds the best score of every nonterminal over every substring as a float, cells are padded
+ * to a multiple of LANES nonterminals. Binary rules are grouped by their right side nonterminals (B, C)
+ * and every group keeps a dense row of weights over the range of its left side nonterminals (-inf where
+ * there is no rule), so the max-plus update cell[A] = max(cell[A], left[B] + right[C] + weight[A]) is a
+ * branch free loop over contiguous floats, which the compiler turns into SIMD code block by block.
+ *
+ * Next to the scores the chart keeps the argmax of every entry, the rule and the split which produced the score,
+ * packed into one uint32 (the split in the upper and the rule in the lower 16 bits) in an array of the same layout.
+ * The update selects it with the same comparison as the score, so the best derivation is read off the chart without
+ * comparing floats again. One array instead of two keeps the update at a compare and two blends per block, packing
+ * limits grammars to 65536 rules and words to 65536 symbols, far beyond what a cubic chart fits in memory anyway.
+ * The buffers are kept between calls like in Parser.
+ */
+class WeightedParser {
+public:
+    static constexpr size_t LANES = 8;
+
+    static constexpr size_t MAX_PACKED = size_t(1) << 16;
+
+    /**
+     * @param logProbabilities Log-probability of every rule indexed like Grammar::m_Rules, -inf disables the rule.
+     * @throws std::invalid_argument When the number of log-probabilities differs from the number of rules
+     * or there are more than MAX_PACKED rules.
+     */
+    WeightedParser(const Grammar& grammar, const std::vector<double>& logProbabilities)
+        : m_Grammar(compileGrammar(grammar)), m_Weights(logProbabilities.begin(), logProbabilities.end()) {
+        if (logProbabilities.size() != grammar.m_Rules.size())
+            throw std::invalid_argument("expected one log-probability per rule");
+        if (grammar.m_Rules.size() > MAX_PACKED)
+            throw std::invalid_argument("too many rules for the weighted parser");
+        m_Width = (m_Grammar->m_NonterminalCount + LANES - 1) / LANES * LANES;
+
+        std::map<std::pair<size_t, size_t>, std::vector<const CompiledGrammar::BinaryRule*>> groups;
+        for (const auto& rule : m_Grammar->m_BinaryRules)
+            groups[{rule.m_Left, rule.m_Right}].push_back(&rule);
+        for (const auto& [children, rules] : groups) {
+            RuleGroup group{children.first, children.second, SIZE_MAX, 0, m_GroupWeights.size()};
+            for (const auto* rule : rules) {
+                group.m_Begin = std::min(group.m_Begin, rule->m_Nonterminal);
+                group.m_End = std::max(group.m_End, rule->m_Nonterminal + 1);
+            }
+            m_GroupWeights.resize(m_GroupWeights.size() + group.m_End - group.m_Begin, -INFINITY);
+            m_GroupRules.resize(m_GroupWeights.size(), UINT32_MAX);
+            for (const auto* rule : rules) {
+                size_t entry = group.m_Offset + rule->m_Nonterminal - group.m_Begin;
+                if (m_GroupRules[entry] == UINT32_MAX || m_Weights[rule->m_Rule] > m_GroupWeights[entry]) {
+                    m_GroupWeights[entry] = m_Weights[rule->m_Rule];
+                    m_GroupRules[entry] = static_cast<uint32_t>(rule->m_Rule);
                 }
+            }
+            m_Groups.push_back(group);
         }
-    };
-    while (!trace.empty()) {
-        size_t ruleIndex = trace.front();
-        trace.erase(trace.begin());
-        applyRule(ruleIndex);
     }
-    return word;
-}
 
-std::vector<size_t> trace(const Grammar& grammar, const Word& word) {
-    if (word.empty()) {
-        for (size_t i = 0; i < grammar.m_Rules.size(); ++i) 
-            if (grammar.m_Rules[i].first == grammar.m_InitialSymbol && grammar.m_Rules[i].second.empty())
-                return {i};
-        return {};
+    const CompiledGrammar& grammar() const {
+        return *m_Grammar;
+    }
+
+    /**
+     * @brief Finds the most probable leftmost derivation of the word, of equally probable ones the first
+     * the fill found.
+     *
+     * @throws std::length_error When the word is longer than MAX_PACKED symbols.
+     */
+    WeightedTrace trace(const Word& word) {
+        const CompiledGrammar& grammar = *m_Grammar;
+        WeightedTrace result;
+        PARSER_STAT(m_Times = {});
+        if (word.empty()) {
+            if (grammar.m_EpsilonRule && m_Weights[*grammar.m_EpsilonRule] != -INFINITY)
+                result = {{*grammar.m_EpsilonRule}, m_Weights[*grammar.m_EpsilonRule]};
+            return result;
+        }
+        if (!passesStaticFilters(grammar, word))
+            return result;
+
+        size_t n = word.size();
+        if (n > MAX_PACKED)
+            throw std::length_error("word too long for the weighted parser");
+        size_t chartSize = n * (n + 1) / 2 * m_Width;
+        if (m_Chart.size() < chartSize) {
+            m_Chart.resize(chartSize);
+            m_Argmax.resize(chartSize);
+        }
+        PARSER_STAT(auto clock = std::chrono::steady_clock::now());
+        // a score above -inf always comes with its argmax, so only the scores need a reset
+        std::fill_n(m_Chart.begin(), chartSize, -INFINITY);
+        float* chart = m_Chart.data();
+
+        for (size_t charIndex = 0; charIndex < n; ++charIndex) {
+            size_t cell = cellIndex(charIndex, charIndex) * m_Width;
+            for (const auto& rule : grammar.m_TerminalRules[symbolIndex(word[charIndex])])
+                if (m_Weights[rule.m_Rule] > chart[cell + rule.m_Nonterminal]) {
+                    chart[cell + rule.m_Nonterminal] = m_Weights[rule.m_Rule];
+                    m_Argmax[cell + rule.m_Nonterminal] = static_cast<uint32_t>(rule.m_Rule);
+                }
+        }
+        PARSER_STAT(m_Times.m_Diagonal = lap(clock));
+
+        for (size_t len = 2; len <= n; ++len)
+            for (size_t startPos = 0; startPos <= n - len; ++startPos) {
+                size_t endPos = startPos + len - 1;
+                size_t cell = cellIndex(startPos, endPos) * m_Width;
+                for (size_t splitPos = startPos; splitPos < endPos; ++splitPos) {
+                    const float* left = chart + cellIndex(startPos, splitPos) * m_Width;
+                    const float* right = chart + cellIndex(splitPos + 1, endPos) * m_Width;
+                    for (const auto& group : m_Groups) {
+                        float leftScore = left[group.m_Left];
+                        float rightScore = right[group.m_Right];
+                        if (leftScore == -INFINITY || rightScore == -INFINITY)
+                            continue;
+                        size_t first = cell + group.m_Begin;
+                        relax(chart + first, m_Argmax.data() + first, m_GroupWeights.data() + group.m_Offset, m_GroupRules.data() + group.m_Offset,
+                              group.m_End - group.m_Begin, leftScore + rightScore, static_cast<uint32_t>(splitPos) << 16);
+                    }
+                }
+            }
+        PARSER_STAT(m_Times.m_Spans = lap(clock));
+
+        float best = chart[cellIndex(0, n - 1) * m_Width + grammar.m_InitialSymbol];
+        if (best == -INFINITY)
+            return result;
+        result.m_Trace = extractDerivation(grammar, 0, n - 1, [&](size_t nonTerminal, size_t i, size_t j) {
+            uint32_t argmax = m_Argmax[cellIndex(i, j) * m_Width + nonTerminal];
+            return Backpointer{static_cast<int>(argmax & 0xffff), i == j ? -1 : static_cast<int>(argmax >> 16)};
+        });
+        result.m_LogProbability = best;
+        PARSER_STAT(m_Times.m_Backtrack = lap(clock));
+        return result;
     }
-    
-    size_t n = word.size();
-    
+
     /**
-     * @brief Key is nonTerminal, value is 2D vector of size n x n, 
-     * where each cell contains index of rule that generated substring
+     * @brief Phase times of the last traced word (with PARSER_STATS), phases which were skipped are zero.
      */
-    std::map<Symbol, std::vector<std::vector<int>>> table; 
+    const ParserPhaseTimes& phaseTimes() const {
+        return m_Times;
+    }
 
     /**
-     * @brief Initialize table with -1, which means that substring cannot be generated
+     * @brief Size of the chart for a word of the given length in bytes, scores with their argmax.
      */
-    for (const auto& nonTerminal : grammar.m_Nonterminals)
-        table[nonTerminal] = std::vector<std::vector<int>>(n, std::vector<int>(n, -1));
-    
-    /**
-     * @brief Iterates over each character in the word and each rule in the grammar 
-     * and  fills in the diagonal of the table
-     * 
-     *  If a rule is a terminal rule (i.e., it derives a single terminal symbol) and the terminal symbol 
-     *  matches the current character in the word, the function stores the index of this rule in the table 
-     *  for the nonterminal symbol of the rule and the substring of the word consisting of the current character.
-     * 
-     */
-    for (size_t charIndex = 0; charIndex < n; ++charIndex)
-        for (size_t ruleIndex = 0; ruleIndex < grammar.m_Rules.size(); ++ruleIndex){
-            auto& [nonTerminal, ruleRightSide] = grammar.m_Rules[ruleIndex];
-            if (ruleRightSide.size() == 1 && ruleRightSide[0] == word[charIndex])
-                table[nonTerminal][charIndex][charIndex] = ruleIndex;
-        }
-
-    /**
-     * @brief Fills in the table for all substrings of length 2 or more.
-     * 
-     * The function iterates over all possible lengths of substrings, starting positions, split positions, and rules.
-     * If a rule is a nonterminal rule (i.e., it derives two nonterminal symbols) and the rule 
-     * can be used to derive the current substring (the two parts), the function saves the index of this 
-     * rule in the table for the nonterminal symbol of the rule and the current substring.
-     * 
-     * @param len The length of the current substring.
-     * @param startPos The starting position of the current substring in the word.
-     * @param splitPos The position where the current substring is split into two parts.
-     * @param ruleIndex The index of the current rule in the list of grammar rules.
-     */
-    for (size_t len = 2; len <= n; ++len)
-        for (size_t startPos = 0; startPos <= n - len; ++startPos)
-            for (size_t splitPos = startPos; splitPos < startPos + len - 1; ++splitPos)
-                for (size_t ruleIndex = 0; ruleIndex < grammar.m_Rules.size(); ++ruleIndex){
-                    auto& [nonTerminal, ruleRightSide] = grammar.m_Rules[ruleIndex];
-                    if (ruleRightSide.size() == 2 &&
-                        table[ruleRightSide[0]][startPos][splitPos] != -1 && 
-                        table[ruleRightSide[1]][splitPos + 1][startPos + len - 1] != -1)
-                            table[nonTerminal][startPos][startPos + len - 1] = ruleIndex;
-                    
-                }       
-    /**
-     * @brief Backtracks through the table to find a sequence of rule indices that can derive the word.
-     * 
-     * The function first checks if the initial symbol can derive the entire word. If it can, the function creates a lambda function for backtracking.
-     * The lambda function takes a nonterminal symbol and the start and end indices of a substring of the word as parameters.
-     * If the start and end indices are the same, the function adds the index of the rule used to derive the terminal symbol at this position to the result vector.
-     * If the start and end indices are different, the function iterates over all possible split positions within the substring.
-     * If it finds a split position where the two parts of the substring can be derived by two nonterminal symbols according to a rule in the grammar,
-     * the function adds the index of this rule to the result vector and recursively calls itself for the two parts of the substring.
-     * After defining the lambda function, the function calls it for the initial symbol and the entire word.
-     * 
-     * @return A vector of indices of rules in the grammar that can derive the word in the order they are applied
+    size_t chartBytes(size_t length) const {
+        return length * (length + 1) / 2 * m_Width * (sizeof(float) + sizeof(uint32_t));
+    }
+
+    /**
+     * @brief Bytes held by the chart buffers, which keep the size of the longest word traced so far.
      */
-    std::vector<size_t> result;
-    if (table[grammar.m_InitialSymbol][0][n - 1] != -1){ // if initial symbol generates whole word
-        std::function<void(Symbol, size_t, size_t)> backtrack = [&](Symbol current, size_t i, size_t j) {
-            if (i == j){ // if current symbol is terminal, base case
-                result.push_back(table[current][i][j]);
-                return;
+    size_t workspaceBytes() const {
+        return m_Chart.capacity() * sizeof(float) + m_Argmax.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    /**
+     * @brief Binary rules sharing their right side, weights of their left sides are stored in
+     * m_GroupWeights[m_Offset, m_Offset + m_End - m_Begin) for nonterminals [m_Begin, m_End).
+     */
+    struct RuleGroup {
+        size_t m_Left;
+        size_t m_Right;
+        size_t m_Begin;
+        size_t m_End;
+        size_t m_Offset;
+    };
+
+    /**
+     * @brief The max-plus update of count scores, an entry which improves takes the rule of its weight together with
+     * the split (already shifted to the upper bits). Every block of LANES entries is computed before anything is
+     * stored, so the compiler vectorizes it (a compare and two blends) without proving that the arrays never overlap.
+     * Groups with a single rule only take the scalar tail, which writes an entry only when it improves: improvements
+     * get rare as the splits go on and the branch is cheaper than blending every entry.
+     */
+    static void relax(float* scores, uint32_t* argmax, const float* weights, const uint32_t* weightRules, size_t count, float base, uint32_t split) {
+        size_t block = 0;
+        for (; block + LANES <= count; block += LANES) {
+            float lanes[LANES];
+            uint32_t argmaxLanes[LANES];
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                float candidate = base + weights[block + lane];
+                uint32_t better = -uint32_t(scores[block + lane] < candidate); // all bits set when the entry improves
+                lanes[lane] = std::max(scores[block + lane], candidate);
+                argmaxLanes[lane] = ((weightRules[block + lane] | split) & better) | (argmax[block + lane] & ~better);
             }
-            for (size_t k = i; k < j; ++k) // for each split pos within substring
-                if (table[grammar.m_Rules[table[current][i][j]].second[0]][i][k] != -1 && // if 2 nonTerminals generate substring
-                    table[grammar.m_Rules[table[current][i][j]].second[1]][k + 1][j] != -1){ //can generate two parts of substring at split k
-                    result.push_back(table[current][i][j]);
-                    backtrack(grammar.m_Rules[table[current][i][j]].second[0], i, k);
-                    backtrack(grammar.m_Rules[table[current][i][j]].second[1], k + 1, j);
-                    return;
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                scores[block + lane] = lanes[lane];
+                argmax[block + lane] = argmaxLanes[lane];
+            }
+        }
+        for (; block < count; ++block) {
+            float candidate = base + weights[block];
+            if (scores[block] < candidate) {
+                scores[block] = candidate;
+                argmax[block] = weightRules[block] | split;
+            }
+        }
+    }
+
+    std::shared_ptr<const CompiledGrammar> m_Grammar;
+    std::vector<float> m_Weights;
+    size_t m_Width = 0;
+    std::vector<RuleGroup> m_Groups;
+    std::vector<float> m_GroupWeights;
+    std::vector<uint32_t> m_GroupRules;
+    std::vector<float> m_Chart;
+    std::vector<uint32_t> m_Argmax;
+    ParserPhaseTimes m_Times;
+};
+
+/**
+ * @brief Replays a leftmost derivation in one pass over the trace.
+ *
+ * Pending symbols of the sentential form are kept on an explicit stack (leftmost on top), terminals go
+ * straight to the word and every nonterminal is expanded by the rule under the cursor, which has to have
+ * this nonterminal on its left side.
+ *
+ * @param isTerminal Terminal flags indexed by symbolIndex().
+ * @return False when the trace is not a complete leftmost derivation from the initial symbol.
+ */
+bool replayDerivation(const Grammar& grammar, const std::array<bool, 256>& isTerminal, const std::vector<size_t>& trace, Word& word) {
+    word.clear();
+    std::vector<Symbol> stack{grammar.m_InitialSymbol};
+    size_t cursor = 0;
+    while (!stack.empty()) {
+        Symbol symbol = stack.back();
+        stack.pop_back();
+        if (isTerminal[symbolIndex(symbol)]) {
+            word.push_back(symbol);
+            continue;
+        }
+
+        if (cursor == trace.size() || trace[cursor] >= grammar.m_Rules.size())
+            return false;
+        const auto& [nonTerminal, ruleRightSide] = grammar.m_Rules[trace[cursor++]];
+        if (nonTerminal != symbol)
+            return false;
+        stack.insert(stack.end(), ruleRightSide.rbegin(), ruleRightSide.rend());
+    }
+    return cursor == trace.size();
+}
+
+/**
+ * @brief Terminal flags of the grammar indexed by symbolIndex().
+ */
+std::array<bool, 256> terminalTable(const Grammar& grammar) {
+    std::array<bool, 256> isTerminal{};
+    for (const auto& terminal : grammar.m_Terminals)
+        isTerminal[symbolIndex(terminal)] = true;
+    return isTerminal;
+}
+
+/**
+ * @brief Reconstructs the word from a given sequence of rule indices.
+ *
+ * The sequence is replayed as a leftmost derivation from the initial symbol, see replayDerivation().
+ *
+ * @param grammar The context-free grammar used for parsing.
+ * @param trace A sequence of indices of rules in the grammar that can derive the word.
+ * @return The word derived from the sequence of rule indices, empty if the sequence is not a valid derivation.
+ */
+Word reconstructWord(const Grammar& grammar, const std::vector<size_t>& trace) {
+    Word word;
+    if (!replayDerivation(grammar, terminalTable(grammar), trace, word))
+        word.clear();
+    return word;
+}
+
+/**
+ * @brief Checks that the trace is a leftmost derivation of the word.
+ */
+bool verifyTrace(const Grammar& grammar, const Word& word, const std::vector<size_t>& trace) {
+    Word derived;
+    return replayDerivation(grammar, terminalTable(grammar), trace, derived) && derived == word;
+}
+
+/**
+ * @brief Verifies batch of (word, trace) pairs, spreading them across threadCount threads (0 means all hardware threads).
+ *
+ * @return For every pair whether the trace is a leftmost derivation of the word.
+ */
+std::vector<bool> verifyTraces(const Grammar& grammar, const std::vector<std::pair<Word, std::vector<size_t>>>& pairs, size_t threadCount = 0) {
+    std::array<bool, 256> isTerminal = terminalTable(grammar);
+    std::vector<char> valid(pairs.size());
+    std::vector<Word> derived(threadCount == 0 ? std::max<size_t>(1, std::thread::hardware_concurrency()) : threadCount);
+
+    parallelFor(pairs.size(), derived.size(), [&](size_t index, size_t worker) {
+        valid[index] = replayDerivation(grammar, isTerminal, pairs[index].second, derived[worker]) &&
+                       derived[worker] == pairs[index].first;
+    });
+    return std::vector<bool>(valid.begin(), valid.end());
+}
+
+// random grammars and words for the tests and the benchmarks, the tools get them with TEST_HELPERS defined
+#if !defined(__PROGTEST__) || defined(TEST_HELPERS)
+/**
+ * @brief Parameters of a random grammar, see randomGrammar().
+ */
+struct GrammarShape {
+    size_t m_Nonterminals = 8;
+    size_t m_Terminals = 2;
+    /**
+     * @brief Probability of every possible binary rule A -> BC, higher density means more ambiguity.
+     */
+    double m_RuleDensity = 0.1;
+    size_t m_TerminalRulesPerNonterminal = 1;
+};
+
+/**
+ * @brief Generates a random grammar in the normal form.
+ *
+ * Terminals are 'a', 'b', ..., nonterminals are the following byte values starting at 'A' which are not
+ * terminals, the first one is the initial symbol. Every nonterminal gets at least one terminal rule
+ * (so every nonterminal is productive and randomMember() can always finish a word) and at least one binary rule.
+ */
+Grammar randomGrammar(std::mt19937& random, const GrammarShape& shape) {
+    Grammar grammar{{}, {}, {}, 'A'};
+    for (size_t i = 0; i < shape.m_Terminals; ++i)
+        grammar.m_Terminals.insert(static_cast<Symbol>('a' + i));
+
+    std::vector<Symbol> nonTerminals;
+    for (int symbol = 'A'; nonTerminals.size() < shape.m_Nonterminals && symbol < 256; ++symbol)
+        if (!grammar.m_Terminals.count(static_cast<Symbol>(symbol)))
+            nonTerminals.push_back(static_cast<Symbol>(symbol));
+    grammar.m_Nonterminals.insert(nonTerminals.begin(), nonTerminals.end());
+
+    std::vector<Symbol> terminals(grammar.m_Terminals.begin(), grammar.m_Terminals.end());
+    std::uniform_real_distribution<double> coin(0, 1);
+    for (Symbol nonTerminal : nonTerminals) {
+        std::vector<Symbol> shuffled = terminals;
+        std::shuffle(shuffled.begin(), shuffled.end(), random);
+        for (size_t i = 0; i < std::min(std::max<size_t>(1, shape.m_TerminalRulesPerNonterminal), shuffled.size()); ++i)
+            grammar.m_Rules.push_back({nonTerminal, {shuffled[i]}});
+
+        size_t binaryRules = 0;
+        for (Symbol left : nonTerminals)
+            for (Symbol right : nonTerminals)
+                if (coin(random) < shape.m_RuleDensity) {
+                    grammar.m_Rules.push_back({nonTerminal, {left, right}});
+                    ++binaryRules;
                 }
-        };
-        backtrack(grammar.m_InitialSymbol, 0, n - 1);
+        if (binaryRules == 0) {
+            std::uniform_int_distribution<size_t> pick(0, nonTerminals.size() - 1);
+            grammar.m_Rules.push_back({nonTerminal, {nonTerminals[pick(random)], nonTerminals[pick(random)]}});
+        }
     }
-    return result;
+    return grammar;
+}
+
+/**
+ * @brief Generates a random word of the given length from the language of the grammar.
+ *
+ * The derivation tree is grown from the initial symbol by rewriting a random leaf with a random binary rule
+ * until it has the requested number of leaves, then every leaf takes a random terminal rule.
+ *
+ * @return The word, or std::nullopt when some leaf has no rule to take (the grammar does not come from randomGrammar()).
+ */
+std::optional<Word> randomMember(std::mt19937& random, const Grammar& grammar, size_t length) {
+    if (length == 0)
+        return std::nullopt;
+    std::map<Symbol, std::vector<const std::vector<Symbol>*>> binaryRules, terminalRules;
+    for (const auto& [nonTerminal, ruleRightSide] : grammar.m_Rules)
+        if (ruleRightSide.size() == 2)
+            binaryRules[nonTerminal].push_back(&ruleRightSide);
+        else if (ruleRightSide.size() == 1)
+            terminalRules[nonTerminal].push_back(&ruleRightSide);
+    auto pick = [&](const std::vector<const std::vector<Symbol>*>& rules) {
+        return rules[std::uniform_int_distribution<size_t>(0, rules.size() - 1)(random)];
+    };
+
+    struct Node {
+        Symbol m_Symbol;
+        size_t m_Left = 0;
+        size_t m_Right = 0;
+    };
+    std::vector<Node> tree{{grammar.m_InitialSymbol}};
+    std::vector<size_t> leaves{0};
+    while (leaves.size() < length) {
+        size_t position = std::uniform_int_distribution<size_t>(0, leaves.size() - 1)(random);
+        size_t leaf = leaves[position];
+        auto rules = binaryRules.find(tree[leaf].m_Symbol);
+        if (rules == binaryRules.end())
+            return std::nullopt;
+        const auto& ruleRightSide = *pick(rules->second);
+        tree[leaf].m_Left = tree.size();
+        tree[leaf].m_Right = tree.size() + 1;
+        tree.push_back({ruleRightSide[0]});
+        tree.push_back({ruleRightSide[1]});
+        leaves[position] = tree[leaf].m_Left;
+        leaves.push_back(tree[leaf].m_Right);
+    }
+
+    Word word;
+    std::vector<size_t> stack{0};
+    while (!stack.empty()) {
+        const Node& node = tree[stack.back()];
+        stack.pop_back();
+        if (node.m_Left != 0) {
+            stack.push_back(node.m_Right);
+            stack.push_back(node.m_Left);
+            continue;
+        }
+        auto rules = terminalRules.find(node.m_Symbol);
+        if (rules == terminalRules.end())
+            return std::nullopt;
+        word.push_back((*pick(rules->second))[0]);
+    }
+    return word;
+}
+
+/**
+ * @brief Generates a uniformly random word over the terminals of the grammar.
+ */
+Word randomWord(std::mt19937& random, const Grammar& grammar, size_t length) {
+    std::vector<Symbol> terminals(grammar.m_Terminals.begin(), grammar.m_Terminals.end());
+    std::uniform_int_distribution<size_t> pick(0, terminals.size() - 1);
+    Word word(length);
+    for (auto& symbol : word)
+        symbol = terminals[pick(random)];
+    return word;
+}
+#endif
+
+#ifndef __PROGTEST__
+/**
+ * @brief Grammar for the benchmarks with words which are (or are expected not to be) in its language.
+ */
+struct BenchmarkCase {
+    std::string m_Name;
+    Grammar m_Grammar;
+    std::vector<std::pair<std::string, Word>> m_Words;
+};
+
+/**
+ * @brief Benchmarks trace() engines on random and structured grammars, one JSON object per line on stdout.
+ *
+ * Options: --lengths 64,256 (word lengths), --engines cyk,compact,earley,automaton,auto,weighted, --seed 1,
+ * --repeat 3 (best of), --nonterminals 8, --density 0.1, --long 10000 (length of the structured long words),
+ * --cubic-limit 1024. Cells per second are nominal (n * (n + 1) / 2 * |N| / time of the whole trace) for all
+ * engines, so they compare the engines on the same scale. The weighted engine is WeightedParser with random rule
+ * log-probabilities. Words longer than the cubic limit are reported as skipped for the engines which would parse them by CYK.
+ *
+ * Times of the phases (diagonal_s, spans_s, backtrack_s) come from the instrumentation, so they are reported only by
+ * a build with PARSER_STATS defined (g++ -O2 -DPARSER_STATS main.cpp), whose totals include the cost of the counters.
+ * Every word is traced by a fresh parser, so workspace_bytes are the buffers that word needed, chart_bytes is the
+ * nominal size of the CYK chart.
+ */
+int runBenchmarks(int argc, char** argv) {
+    const std::map<std::string, std::pair<ParserEngine, ChartMode>> engineModes{
+        {"cyk", {ParserEngine::Cyk, ChartMode::Backpointers}},
+        {"compact", {ParserEngine::Cyk, ChartMode::Compact}},
+        {"earley", {ParserEngine::Earley, ChartMode::Auto}},
+        {"automaton", {ParserEngine::Automaton, ChartMode::Auto}},
+        {"auto", {ParserEngine::Auto, ChartMode::Auto}},
+        {"weighted", {ParserEngine::Cyk, ChartMode::Auto}},
+    };
+    std::vector<size_t> lengths{64, 256};
+    std::vector<std::string> engines{"cyk", "compact", "earley", "automaton", "auto", "weighted"};
+    unsigned seed = 1;
+    size_t repeat = 3, longLength = 10000, cubicLimit = 1024;
+    GrammarShape shape;
+
+    auto split = [](const std::string& list) {
+        std::vector<std::string> items;
+        std::istringstream stream(list);
+        for (std::string item; std::getline(stream, item, ',');)
+            items.push_back(item);
+        return items;
+    };
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string option = argv[i], value = argv[i + 1];
+        if (option == "--lengths") {
+            lengths.clear();
+            for (const auto& item : split(value))
+                lengths.push_back(std::stoul(item));
+        }
+        else if (option == "--engines") {
+            engines = split(value);
+            for (const auto& engine : engines)
+                if (!engineModes.count(engine)) {
+                    std::cerr << "unknown engine " << engine << std::endl;
+                    return 1;
+                }
+        }
+        else if (option == "--long")
+            longLength = std::stoul(value);
+        else if (option == "--cubic-limit")
+            cubicLimit = std::stoul(value);
+        else if (option == "--seed")
+            seed = std::stoul(value);
+        else if (option == "--repeat")
+            repeat = std::max<size_t>(1, std::stoul(value));
+        else if (option == "--nonterminals")
+            shape.m_Nonterminals = std::stoul(value);
+        else if (option == "--density")
+            shape.m_RuleDensity = std::stod(value);
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::mt19937 random(seed);
+    std::vector<BenchmarkCase> cases;
+    GrammarShape ambiguous = shape;
+    ambiguous.m_RuleDensity = std::min(1.0, shape.m_RuleDensity * 4);
+    for (const auto& [name, currentShape] : {std::make_pair("random", shape), std::make_pair("random-ambiguous", ambiguous)}) {
+        BenchmarkCase current{name, randomGrammar(random, currentShape), {}};
+        for (size_t length : lengths) {
+            if (auto member = randomMember(random, current.m_Grammar, length))
+                current.m_Words.emplace_back("member", *member);
+            current.m_Words.emplace_back("random", randomWord(random, current.m_Grammar, length));
+        }
+        cases.push_back(current);
+    }
+
+    BenchmarkCase nested{"nested", {{'L', 'R', 'S', 'T'}, {'(', ')', 'c'}, {{'S', {'c'}}, {'S', {'L', 'T'}}, {'T', {'S', 'R'}}, {'L', {'('}}, {'R', {')'}}}, 'S'}, {}};
+    BenchmarkCase all{"all-words", {{'S'}, {'a', 'b'}, {{'S', {'S', 'S'}}, {'S', {'a'}}, {'S', {'b'}}}, 'S'}, {}};
+    for (size_t length : lengths) {
+        Word member(length / 2, '(');
+        member.push_back('c');
+        member.insert(member.end(), length / 2, ')');
+        nested.m_Words.emplace_back("member", member);
+        member.back() = '(';
+        nested.m_Words.emplace_back("non-member", member);
+        all.m_Words.emplace_back("member", randomWord(random, all.m_Grammar, length));
+    }
+    BenchmarkCase regular{"regular", {{'A', 'B', 'S', 'X'}, {'a', 'b', 'c'}, {{'S', {'A', 'X'}}, {'S', {'c'}}, {'X', {'B', 'S'}}, {'A', {'a'}}, {'B', {'b'}}}, 'S'}, {}};
+    Word longNested(longLength / 2, '(');
+    longNested.push_back('c');
+    longNested.insert(longNested.end(), longLength / 2, ')');
+    nested.m_Words.emplace_back("long-member", longNested);
+    Word longRegular;
+    for (size_t i = 0; i < longLength / 2; ++i)
+        longRegular.insert(longRegular.end(), {'a', 'b'});
+    longRegular.push_back('c');
+    regular.m_Words.emplace_back("long-member", longRegular);
+    longRegular[longRegular.size() / 2] = 'c';
+    regular.m_Words.emplace_back("long-non-member", longRegular);
+    cases.push_back(nested);
+    cases.push_back(all);
+    cases.push_back(regular);
+
+    for (const auto& benchmark : cases)
+        for (const auto& engineName : engines) {
+            auto grammar = compileGrammar(benchmark.m_Grammar);
+            size_t width = grammar->m_NonterminalCount;
+            bool weighted = engineName == "weighted";
+            std::vector<double> logProbabilities;
+            for (size_t i = 0; i < benchmark.m_Grammar.m_Rules.size(); ++i)
+                logProbabilities.push_back(std::log(std::uniform_real_distribution<double>(0.01, 1)(random)));
+
+            for (const auto& [kind, word] : benchmark.m_Words) {
+                Parser parser(grammar, engineModes.at(engineName).first);
+                parser.setChartMode(engineModes.at(engineName).second);
+                WeightedParser weightedParser(benchmark.m_Grammar, logProbabilities);
+                bool cubic = weighted || parser.engine() == ParserEngine::Cyk;
+                if (cubic && word.size() > cubicLimit) {
+                    std::cout << "{\"grammar\":\"" << benchmark.m_Name << "\""
+                              << ",\"engine\":\"" << engineName << "\""
+                              << ",\"word\":\"" << kind << "\""
+                              << ",\"length\":" << word.size()
+                              << ",\"skipped\":true}" << std::endl;
+                    continue;
+                }
+                ParserPhaseTimes best;
+                double bestTotal = INFINITY;
+                std::vector<size_t> result;
+                for (size_t run = 0; run < repeat; ++run) {
+                    auto start = std::chrono::steady_clock::now();
+                    result = weighted ? weightedParser.trace(word).m_Trace : parser.trace(word);
+                    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    if (total < bestTotal) {
+                        bestTotal = total;
+                        best = weighted ? weightedParser.phaseTimes() : parser.phaseTimes();
+                    }
+                }
+                assert(result.empty() || verifyTrace(benchmark.m_Grammar, word, result));
+
+                size_t n = word.size();
+                double cells = double(n) * (n + 1) / 2 * width;
+                std::cout << "{\"grammar\":\"" << benchmark.m_Name << "\""
+                          << ",\"nonterminals\":" << benchmark.m_Grammar.m_Nonterminals.size()
+                          << ",\"rules\":" << benchmark.m_Grammar.m_Rules.size()
+                          << ",\"engine\":\"" << engineName << "\""
+                          << ",\"word\":\"" << kind << "\""
+                          << ",\"length\":" << n
+                          << ",\"accepted\":" << (result.empty() ? "false" : "true")
+                          << ",\"trace_length\":" << result.size();
+#ifdef PARSER_STATS
+                std::cout << ",\"diagonal_s\":" << best.m_Diagonal
+                          << ",\"spans_s\":" << best.m_Spans
+                          << ",\"backtrack_s\":" << best.m_Backtrack;
+#endif
+                std::cout << ",\"total_s\":" << bestTotal
+                          << ",\"cells_per_s\":" << (bestTotal > 0 ? cells / bestTotal : 0)
+                          << ",\"chart_bytes\":" << (weighted ? weightedParser.chartBytes(n) : cubic ? parser.chartBytes(n, parser.chartModeFor(n)) : 0)
+                          << ",\"workspace_bytes\":" << (weighted ? weightedParser.workspaceBytes() : parser.workspaceBytes()) << "}" << std::endl;
+            }
+        }
+    return 0;
 }
 
-int main(){
+int main(int argc, char** argv){
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+        return runBenchmarks(argc, argv);
+
     Grammar g0{
         {'A', 'B', 'C', 'S'},
         {'a', 'b'},
@@ -245,4 +2688,484 @@ int main(){
     assert(reconstructWord(g3, trace(g3, {})) == Word({}));
     assert(reconstructWord(g3, trace(g3, {'a', 'b', 'a', 'a', 'b'})) == Word({'a', 'b', 'a', 'a', 'b'}));
     assert(reconstructWord(g3, trace(g3, {'a', 'b', 'a', 'a', 'b', 'a', 'b', 'a', 'b', 'a', 'a'})) == Word({'a', 'b', 'a', 'a', 'b', 'a', 'b', 'a', 'b', 'a', 'a'}));
-}
\ No newline at end of file
+
+    Parser p0(g0);
+    std::vector<Word> words0{{'b', 'a', 'a', 'b', 'a'}, {'b'}, {}, {'a', 'b'}, {'c', 'a'}, {'a', 'a', 'a', 'a', 'a'}};
+    auto traces0 = p0.traceBatch(words0, 3);
+    assert(traces0.size() == words0.size());
+    for (size_t i = 0; i < words0.size(); ++i) {
+        assert(traces0[i] == trace(g0, words0[i]));
+        assert(traces0[i] == p0.trace(words0[i]));
+    }
+
+    Parser p1(g1);
+    std::vector<Word> words1;
+    for (size_t len = 0; len < 40; ++len)
+        words1.emplace_back(len, 'x');
+    auto traces1 = p1.traceBatch(words1);
+    for (size_t i = 0; i < words1.size(); ++i)
+        assert(reconstructWord(g1, traces1[i]) == words1[i]);
+
+    Grammar g4{
+        {'A', 'S'},
+        {'a'},
+        {
+            {'S', {'A', 'S'}},
+            {'S', {'a'}},
+            {'A', {'a'}},
+        },
+        'S'};
+    Word long4(500, 'a');
+    auto trace4 = trace(g4, long4);
+    assert(trace4.size() == 2 * long4.size() - 1);
+    assert(reconstructWord(g4, trace4) == long4);
+
+    assert(verifyTrace(g0, {'a', 'b'}, trace(g0, {'a', 'b'})));
+    assert(!verifyTrace(g0, {'b', 'a'}, trace(g0, {'a', 'b'})));
+    assert(!verifyTrace(g0, {'a', 'b'}, {0, 3}));
+    assert(!verifyTrace(g0, {'a', 'b'}, {0, 3, 5, 5}));
+    assert(!verifyTrace(g0, {'a', 'b'}, {2, 3, 5}));
+    assert(verifyTrace(g1, {}, {0}));
+    assert(!verifyTrace(g0, {}, {}));
+
+    std::vector<std::pair<Word, std::vector<size_t>>> pairs1;
+    for (size_t i = 0; i < words1.size(); ++i)
+        pairs1.emplace_back(words1[i], traces1[i]);
+    pairs1.emplace_back(Word{'x', 'x'}, traces1[3]);
+    pairs1.emplace_back(long4, trace4);
+    auto valid1 = verifyTraces(g1, pairs1, 4);
+    for (size_t i = 0; i < words1.size(); ++i)
+        assert(valid1[i]);
+    assert(!valid1[words1.size()]);
+    assert(!valid1[words1.size() + 1]);
+
+    Grammar g5{
+        {'L', 'R', 'S', 'T'},
+        {'(', ')', 'c'},
+        {
+            {'S', {'c'}},
+            {'S', {'L', 'T'}},
+            {'T', {'S', 'R'}},
+            {'L', {'('}},
+            {'R', {')'}},
+        },
+        'S'};
+    assert(Parser(g5).engine() == ParserEngine::Earley);
+    assert(Parser(g0).engine() == ParserEngine::Cyk);
+    Word nested5(1000, '(');
+    nested5.push_back('c');
+    nested5.insert(nested5.end(), 1000, ')');
+    assert(reconstructWord(g5, trace(g5, nested5)) == nested5);
+    nested5.pop_back();
+    assert(trace(g5, nested5).empty());
+
+    for (const Grammar& grammar : {g0, g1, g2, g3, g4, g5}) {
+        Parser cyk(grammar, ParserEngine::Cyk);
+        Parser earley(grammar, ParserEngine::Earley);
+        Parser automaton(grammar, ParserEngine::Automaton);
+        std::vector<Word> words{{}};
+        std::vector<Symbol> terminals(grammar.m_Terminals.begin(), grammar.m_Terminals.end());
+        for (size_t len = 1; len <= 7; ++len) {
+            std::vector<size_t> digits(len, 0);
+            for (bool more = true; more;) {
+                Word word;
+                for (size_t digit : digits)
+                    word.push_back(terminals[digit]);
+                words.push_back(word);
+                size_t i = 0;
+                while (i < len && ++digits[i] == terminals.size())
+                    digits[i++] = 0;
+                more = i < len;
+            }
+        }
+        auto tracesCyk = cyk.traceBatch(words, 2);
+        auto tracesEarley = earley.traceBatch(words, 2);
+        auto tracesAutomaton = automaton.traceBatch(words, 2);
+        for (size_t i = 0; i < words.size(); ++i) {
+            assert(tracesCyk[i].empty() == tracesEarley[i].empty());
+            assert(tracesEarley[i].empty() || verifyTrace(grammar, words[i], tracesEarley[i]));
+            assert(tracesCyk[i].empty() == tracesAutomaton[i].empty());
+            assert(tracesAutomaton[i].empty() || verifyTrace(grammar, words[i], tracesAutomaton[i]));
+        }
+    }
+
+    ParserSession session3(g3);
+    Word prefix3;
+    assert(session3.accepts() == !trace(g3, prefix3).empty());
+    for (Symbol symbol : {'a', 'b', 'a', 'a', 'b', 'a', 'b', 'a', 'b', 'a', 'a', 'c', 'a'}) {
+        session3.push(symbol);
+        prefix3.push_back(symbol);
+        assert(session3.size() == prefix3.size());
+        assert(session3.accepts() == !trace(g3, prefix3).empty());
+        assert(!session3.accepts() || verifyTrace(g3, prefix3, session3.trace()));
+    }
+    session3.clear();
+    session3.push('a');
+    assert(session3.trace() == trace(g3, {'a'}));
+
+    ParserSession session1(g1);
+    assert(session1.trace() == std::vector<size_t>({0}));
+    for (size_t len = 1; len <= 30; ++len) {
+        session1.push('x');
+        assert(reconstructWord(g1, session1.trace()) == Word(len, 'x'));
+    }
+
+    Grammar g6{
+        {'A', 'B', 'C', 'D', 'S', 'U', 'X'},
+        {'a', 'b'},
+        {
+            {'U', {'a'}},
+            {'S', {'X', 'A'}},
+            {'X', {'X', 'A'}},
+            {'S', {'A', 'B'}},
+            {'A', {'a'}},
+            {'U', {'S', 'S'}},
+            {'B', {'b'}},
+            {'B', {'D', 'X'}},
+            {'S', {'S', 'B'}},
+            {'C', {'U', 'A'}},
+        },
+        'S'};
+    GrammarReduction reduction6 = reduceGrammar(g6);
+    assert(reduction6.m_Grammar.m_Nonterminals == std::set<Symbol>({'A', 'B', 'S'}));
+    assert(reduction6.m_RuleMap == std::vector<size_t>({3, 4, 6, 8}));
+    assert(compileGrammar(g6)->m_NonterminalCount == 3);
+    assert(trace(g6, {'a', 'b', 'b'}) == std::vector<size_t>({8, 3, 4, 6, 6}));
+    assert(trace(g6, {'a', 'a'}).empty());
+    ParserSession session6(g6);
+    for (Symbol symbol : {'a', 'b', 'b', 'b'})
+        session6.push(symbol);
+    assert(verifyTrace(g6, {'a', 'b', 'b', 'b'}, session6.trace()));
+
+    Grammar g7{{'S', 'X'}, {'a'}, {{'S', {'X', 'X'}}, {'X', {'X', 'X'}}}, 'S'};
+    assert(reduceGrammar(g7).m_Grammar.m_Nonterminals == std::set<Symbol>({'S'}));
+    assert(reduceGrammar(g7).m_Grammar.m_Rules.empty());
+    assert(trace(g7, {'a'}).empty());
+    assert(trace(g7, {}).empty());
+
+    std::vector<Grammar> grammars{g0, g1, g2, g3, g4, g5, g6, g7};
+    Classifier classifier(grammars);
+    assert(classifier.size() == grammars.size());
+    for (const Word& word : std::vector<Word>{{}, {'a'}, {'x', 'x'}, {'a', 'b'}, {'a', 'a', 'a'}, {'(', 'c', ')'}, {'z'}}) {
+        auto classifications = classifier.classify(word, false, 3);
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < grammars.size(); ++i)
+            if (!trace(grammars[i], word).empty())
+                expected.push_back(i);
+        assert(classifications.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            assert(classifications[i].m_Grammar == expected[i]);
+            assert(verifyTrace(grammars[expected[i]], word, classifications[i].m_Trace));
+        }
+
+        for (size_t threads : {1, 4}) {
+            auto first = classifier.classify(word, true, threads);
+            assert(first.size() == std::min<size_t>(1, expected.size()));
+            assert(first.empty() || first[0].m_Grammar == expected[0]);
+        }
+    }
+
+    std::vector<Grammar> many;
+    for (size_t i = 0; i < 70; ++i)
+        many.push_back(i % 10 == 7 ? g1 : g5);
+    Classifier manyClassifier(many);
+    for (size_t i = 0; i < 20; ++i) {
+        assert(manyClassifier.classify({'x', 'x'}, true, 4)[0].m_Grammar == 7);
+        assert(manyClassifier.classify({'x', 'x'}, false, 4).size() == 7);
+        assert(manyClassifier.classify({'(', 'c', ')'}, true, 4)[0].m_Grammar == 0);
+    }
+
+    for (const Grammar& grammar : {g0, g1, g3, g6}) {
+        Parser full(grammar, ParserEngine::Cyk);
+        Parser compact(grammar, ParserEngine::Cyk);
+        full.setChartMode(ChartMode::Backpointers);
+        compact.setChartMode(ChartMode::Compact);
+        for (const auto& word : words0) {
+            assert(full.trace(word).empty() == compact.trace(word).empty());
+            assert(compact.trace(word).empty() || verifyTrace(grammar, word, compact.trace(word)));
+        }
+    }
+
+    assert(Parser(g0, ParserEngine::Cyk).chartBytes(50000, ChartMode::Compact) == 625012504);
+    assert(Parser(g0, ParserEngine::Cyk).chartBytes(50000, ChartMode::Backpointers) == 40000800000);
+    assert(Parser(g0, ParserEngine::Cyk).chartModeFor(50000) == ChartMode::Compact);
+    bool thrown = false;
+    try {
+        Parser(g0, ParserEngine::Cyk).chartModeFor(100000);
+    }
+    catch (const std::length_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    Parser limited(g1, ParserEngine::Cyk);
+    Word long1(200, 'x');
+    limited.setMemoryLimit(limited.chartBytes(long1.size(), ChartMode::Compact));
+    assert(limited.chartModeFor(long1.size()) == ChartMode::Compact);
+    assert(limited.chartModeFor(10) == ChartMode::Backpointers);
+    assert(reconstructWord(g1, limited.trace(long1)) == long1);
+    limited.setChartMode(ChartMode::Backpointers);
+    thrown = false;
+    try {
+        limited.trace(long1);
+    }
+    catch (const std::length_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(limited.accepts(long1) && !limited.accepts(Word(200, 'y')));
+    limited.setMemoryLimit(limited.chartBytes(long1.size(), ChartMode::Compact) - 1);
+    thrown = false;
+    try {
+        limited.accepts(long1);
+    }
+    catch (const std::length_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    std::mt19937 random(42);
+    for (size_t i = 0; i < 20; ++i) {
+        Grammar grammar = randomGrammar(random, {5, 2, 0.15, 1});
+        assert(grammar.m_Nonterminals.size() == 5);
+        Parser parser(grammar);
+        for (size_t length : {1, 2, 7, 30}) {
+            auto member = randomMember(random, grammar, length);
+            assert(member && member->size() == length);
+            assert(verifyTrace(grammar, *member, parser.trace(*member)));
+            Word word = randomWord(random, grammar, length);
+            auto result = parser.trace(word);
+            assert(result.empty() || verifyTrace(grammar, word, result));
+            for (ParserEngine engine : {ParserEngine::Cyk, ParserEngine::Earley, ParserEngine::Automaton})
+                assert(Parser(grammar, engine).accepts(word) == !result.empty() && Parser(grammar, engine).accepts(*member));
+        }
+    }
+    assert(!randomMember(random, g5, 2));
+    assert(randomMember(random, g5, 3) == Word({'(', 'c', ')'}));
+
+    for (ParserEngine engine : {ParserEngine::Cyk, ParserEngine::Earley})
+        for (ChartMode mode : {ChartMode::Backpointers, ChartMode::Compact}) {
+            Parser parser(g1, engine);
+            parser.setChartMode(mode);
+            std::vector<ParserStats> reported;
+            parser.setStatsCallback([&](const ParserStats& stats) { reported.push_back(stats); });
+            Word word(12, 'x');
+            auto result = parser.trace(word);
+            assert(reported.size() == 1);
+            const ParserStats& stats = parser.stats();
+#ifdef PARSER_STATS
+            assert(stats.m_Length == word.size());
+            assert(stats.m_Times.m_Spans > 0 && stats.m_Times.m_Backtrack >= 0);
+            assert(stats.m_BacktrackSteps == result.size());
+            assert(stats.m_Combinations > 0 && stats.m_RuleEvaluations >= stats.m_Combinations);
+            for (size_t len = 1; len <= word.size(); ++len)
+                assert(stats.m_FilledBySpan[len] >= 1);
+            if (engine == ParserEngine::Cyk)
+                assert(stats.m_FilledBySpan[1] == 2 * word.size());
+#else
+            assert(stats.m_Length == 0 && stats.m_Times.m_Spans == 0);
+            assert(stats.m_RuleEvaluations == 0 && stats.m_FilledBySpan.empty());
+#endif
+            parser.trace({});
+            assert(reported.size() == 2 && reported.back().m_Length == 0);
+        }
+
+    Parser forestParser(g1);
+    ParseForest forest5 = forestParser.forest(Word(5, 'x'));
+    assert(forest5.countDerivations() == 14);
+    assert(forest5.countDerivationsExact().toString() == "14");
+    DerivationEnumerator enumerator5(forest5);
+    std::set<std::vector<size_t>> derivations5;
+    while (auto derivation = enumerator5.next()) {
+        assert(verifyTrace(g1, Word(5, 'x'), *derivation));
+        derivations5.insert(*derivation);
+    }
+    assert(derivations5.size() == 14);
+    assert(!enumerator5.next());
+
+    ParseForest forest40 = forestParser.forest(Word(40, 'x'));
+    assert(forest40.nodes().size() <= 2 * 40 * 41 / 2);
+    assert(forest40.countDerivations() == UINT64_MAX);
+    assert(forest40.countDerivationsExact().toString() == "680425371729975800390");
+    DerivationEnumerator enumerator40(forest40);
+    for (size_t i = 0; i < 100; ++i)
+        assert(verifyTrace(g1, Word(40, 'x'), *enumerator40.next()));
+
+    assert(forestParser.forest({}).countDerivations() == 1);
+    assert(*DerivationEnumerator(forestParser.forest({})).next() == std::vector<size_t>({0}));
+    assert(!forestParser.forest({'y'}).accepted());
+    assert(forestParser.forest({'y'}).countDerivationsExact().toString() == "0");
+    assert(!DerivationEnumerator(forestParser.forest({'y'})).next());
+    assert(Parser(g0).forest({'b', 'a', 'a', 'b', 'a'}).countDerivations() >= 1);
+
+    Grammar g8{
+        {'A', 'B', 'S', 'X'},
+        {'a', 'b', 'c'},
+        {
+            {'S', {'A', 'X'}},
+            {'S', {'c'}},
+            {'X', {'B', 'S'}},
+            {'A', {'a'}},
+            {'B', {'b'}},
+        },
+        'S'};
+    Grammar g9{{'A', 'B', 'S'}, {'a', 'b'}, {{'S', {'A', 'B'}}, {'A', {'a'}}, {'A', {'b'}}, {'B', {'b'}}}, 'S'};
+    assert(isFiniteLanguage(*compileGrammar(g9)));
+    assert(!isFiniteLanguage(*compileGrammar(g8)));
+    assert(!isFiniteLanguage(*compileGrammar(g4)));
+    assert(isSelfEmbedding(*compileGrammar(g5)));
+    assert(!isSelfEmbedding(*compileGrammar(g8)));
+    assert(!isSelfEmbedding(*compileGrammar(g9)));
+    assert(Parser(g8).engine() == ParserEngine::Automaton);
+    assert(Parser(g9).engine() == ParserEngine::Automaton);
+    assert(Parser(g5, ParserEngine::Automaton).engine() == ParserEngine::Cyk);
+    assert(!TraceAutomaton::build(*compileGrammar(g5)));
+
+    auto automaton8 = TraceAutomaton::build(*compileGrammar(g8));
+    Word word8;
+    for (size_t i = 0; i < 5000; ++i)
+        word8.insert(word8.end(), {'a', 'b'});
+    word8.push_back('c');
+    assert(automaton8->accepts(word8));
+    assert(verifyTrace(g8, word8, automaton8->trace(word8)));
+    word8.back() = 'b';
+    assert(!automaton8->accepts(word8));
+    assert(automaton8->trace(word8).empty());
+
+    Grammar g11{
+        {'A', 'B', 'S', 'Y'},
+        {'a', 'b', 'c'},
+        {
+            {'S', {'Y', 'A'}},
+            {'S', {'c'}},
+            {'Y', {'S', 'B'}},
+            {'A', {'a'}},
+            {'B', {'b'}},
+        },
+        'S'};
+    assert(Parser(g11).engine() == ParserEngine::Automaton);
+    auto automaton11 = TraceAutomaton::build(*compileGrammar(g11));
+    assert(automaton11->mirrored() && !automaton8->mirrored());
+    Word word11{'c'};
+    for (size_t i = 0; i < 5000; ++i)
+        word11.insert(word11.end(), {'b', 'a'});
+    assert(automaton11->accepts(word11));
+    assert(verifyTrace(g11, word11, automaton11->trace(word11)));
+    assert(trace(g11, {'c', 'b', 'a'}) == std::vector<size_t>({0, 2, 1, 4, 3}));
+    word11.front() = 'b';
+    assert(!automaton11->accepts(word11));
+    assert(automaton11->trace(word11).empty());
+    Grammar g12{{'A', 'B', 'S', 'X', 'Y'}, {'a', 'b'}, {{'S', {'A', 'B'}}, {'A', {'A', 'X'}}, {'A', {'a'}}, {'X', {'a'}}, {'B', {'Y', 'B'}}, {'B', {'b'}}, {'Y', {'b'}}}, 'S'};
+    assert(!isSelfEmbedding(*compileGrammar(g12)) && !TraceAutomaton::build(*compileGrammar(g12))); //regular, but mixed
+    assert(Parser(g12).engine() != ParserEngine::Automaton);
+    assert(verifyTrace(g12, {'a', 'a', 'b', 'b', 'b'}, trace(g12, {'a', 'a', 'b', 'b', 'b'})));
+    Grammar wide{{'y', 'z'}, {'a', 't', 'u'}, {{'y', {'t'}}, {'z', {'u'}}}, 'A'}; //2^23 chains from the initial symbol
+    for (char level = 'A'; level < 'A' + 24; ++level) {
+        wide.m_Nonterminals.insert(level);
+        if (level == 'A' + 23)
+            wide.m_Rules.push_back({level, {'a'}});
+        else
+            for (char side : {'y', 'z'})
+                wide.m_Rules.push_back({level, {char(level + 1), side}});
+    }
+    assert(!TraceAutomaton::build(*compileGrammar(wide), 16));
+    Parser shared8(compileGrammar(g8), automaton8);
+    assert(shared8.engine() == ParserEngine::Automaton);
+    assert(Parser(compileGrammar(g5), std::shared_ptr<const TraceAutomaton>()).engine() == Parser(g5).engine());
+    word8.back() = 'c';
+    assert(shared8.trace(word8) == automaton8->trace(word8));
+    assert(verifyTrace(g8, word8, trace(g8, word8)));
+    assert(verifyTrace(g8, {'a', 'b', 'c'}, trace(g8, {'a', 'b', 'c'})));
+    assert(trace(g9, {'b', 'b'}) == std::vector<size_t>({0, 2, 3}));
+    assert(trace(g9, {'b', 'a'}).empty());
+
+    assert(compileGrammar(g9)->m_MinLength == 2 && compileGrammar(g9)->m_MaxLength == 2);
+    assert(compileGrammar(g8)->m_MinLength == 1 && compileGrammar(g8)->m_MaxLength == SIZE_MAX);
+    assert(compileGrammar(g7)->m_MinLength == SIZE_MAX);
+    assert(compileGrammar(g5)->m_Last[compileGrammar(g5)->m_InitialSymbol] == std::bitset<256>().set(')').set('c'));
+    Parser filtered(g5, ParserEngine::Cyk);
+    for (const auto& [word, accepted, filteredOut] : {std::make_tuple(Word{'(', 'c', ')', '('}, false, true),
+                                                      std::make_tuple(Word{'(', 'x', ')'}, false, true),
+                                                      std::make_tuple(Word{'(', '(', 'c', ')'}, false, false),
+                                                      std::make_tuple(Word{'(', 'c', ')'}, true, false)}) {
+        assert(filtered.trace(word).empty() != accepted);
+        assert(passesStaticFilters(filtered.grammar(), word) != filteredOut);
+        assert(passesStaticFilters(filtered.grammar(), wordFeatures(word)) != filteredOut);
+        assert(filteredOut || filtered.traceFiltered(word) == filtered.trace(word));
+#ifdef PARSER_STATS
+        assert(filtered.stats().m_Filtered == filteredOut);
+#endif
+    }
+    assert(!passesStaticFilters(*compileGrammar(g9), Word{'a', 'b', 'b'}));
+    assert(!ParseForest::build(*compileGrammar(g9), {'b', 'a'}).accepted());
+    for (size_t i = 0; i < 20; ++i) {
+        Grammar grammar = randomGrammar(random, {6, 3, 0.2, 1});
+        auto compiled = compileGrammar(grammar);
+        for (size_t length : {1, 3, 8, 20})
+            if (auto member = randomMember(random, grammar, length))
+                assert(passesStaticFilters(*compiled, *member));
+    }
+
+    Grammar g10{{'S', 'A', 'T'}, {'a'}, {{'S', {'T', 'T'}}, {'S', {'A', 'A'}}, {'T', {'a'}}, {'A', {'a'}}, {'S', {}}}, 'S'};
+    WeightedParser preferA(g10, {std::log(0.2), std::log(0.3), std::log(1.0), std::log(1.0), std::log(0.1)});
+    WeightedTrace pair = preferA.trace({'a', 'a'});
+    assert(pair.m_Trace == std::vector<size_t>({1, 3, 3}));
+    assert(std::abs(pair.m_LogProbability - std::log(0.3)) < 1e-6);
+    WeightedParser preferT(g10, {std::log(0.4), std::log(0.1), std::log(1.0), std::log(1.0), std::log(0.1)});
+    assert(preferT.trace({'a', 'a'}).m_Trace == std::vector<size_t>({0, 2, 2}));
+    assert(preferT.trace({}).m_Trace == std::vector<size_t>({4}));
+    WeightedParser onlyA(g10, {-INFINITY, 0, -INFINITY, 0, -INFINITY});
+    assert(onlyA.trace({'a', 'a'}).m_Trace == std::vector<size_t>({1, 3, 3}));
+    assert(onlyA.trace({'a'}).m_Trace.empty() && onlyA.trace({'a'}).m_LogProbability == -INFINITY);
+    assert(onlyA.trace({}).m_Trace.empty());
+    Grammar g10twice = g10;
+    g10twice.m_Rules.push_back({'S', {'A', 'A'}});
+    WeightedParser preferSecond(g10twice, {-INFINITY, std::log(0.2), 0, 0, 0, std::log(0.6)});
+    assert(preferSecond.trace({'a', 'a'}).m_Trace == std::vector<size_t>({5, 3, 3}));
+    thrown = false;
+    try {
+        WeightedParser(g10, {0, 0});
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+    Grammar manyRules{{'S'}, {'a'}, std::vector<std::pair<Symbol, std::vector<Symbol>>>(WeightedParser::MAX_PACKED + 1, {'S', {'a'}}), 'S'};
+    thrown = false;
+    try {
+        WeightedParser(manyRules, std::vector<double>(manyRules.m_Rules.size(), 0));
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    for (size_t i = 0; i < 30; ++i) {
+        Grammar grammar = randomGrammar(random, {4 + i % 10, 2, 0.3, 1});
+        std::vector<double> logProbabilities;
+        for (size_t rule = 0; rule < grammar.m_Rules.size(); ++rule)
+            logProbabilities.push_back(std::log(std::uniform_real_distribution<double>(0.01, 1)(random)));
+        WeightedParser weighted(grammar, logProbabilities);
+        Parser parser(grammar);
+        for (size_t length : {1, 2, 5, 7}) {
+            Word word = randomWord(random, grammar, length);
+            WeightedTrace best = weighted.trace(word);
+            assert(best.m_Trace.empty() == parser.trace(word).empty());
+            if (best.m_Trace.empty())
+                continue;
+            assert(verifyTrace(grammar, word, best.m_Trace));
+            auto score = [&](const std::vector<size_t>& derivation) {
+                return std::accumulate(derivation.begin(), derivation.end(), 0.0, [&](double sum, size_t rule) { return sum + logProbabilities[rule]; });
+            };
+            assert(std::abs(score(best.m_Trace) - best.m_LogProbability) < 1e-4);
+            ParseForest forest = parser.forest(word);
+            DerivationEnumerator enumerator(forest);
+            for (size_t count = 0; count < 2000; ++count) {
+                auto derivation = enumerator.next();
+                if (!derivation)
+                    break;
+                assert(score(*derivation) <= best.m_LogProbability + 1e-4);
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,497 @@
+#define TEST_HELPERS
+#include "../solutions.h"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+
+/**
+ * @brief Textbook subset construction without trimming, the reference for determinize().
+ */
+DFA referenceDeterminize(const MISNFA& nfa) {
+    DFA dfa{{0}, nfa.m_Alphabet, {}, 0, {}};
+    std::map<std::set<State>, State> ids{{nfa.m_InitialStates, 0}};
+    std::vector<std::set<State>> subsets{nfa.m_InitialStates};
+    for (State current = 0; current < subsets.size(); ++current) {
+        for (State state : subsets[current])
+            if (nfa.m_FinalStates.count(state))
+                dfa.m_FinalStates.insert(current);
+        for (Symbol symbol : nfa.m_Alphabet) {
+            std::set<State> target;
+            for (State state : subsets[current]) {
+                auto it = nfa.m_Transitions.find({state, symbol});
+                if (it != nfa.m_Transitions.end())
+                    target.insert(it->second.begin(), it->second.end());
+            }
+            auto [it, inserted] = ids.emplace(target, subsets.size());
+            if (inserted) {
+                subsets.push_back(target);
+                dfa.m_States.insert(it->second);
+            }
+            dfa.m_Transitions[{current, symbol}] = it->second;
+        }
+    }
+    return dfa;
+}
+
+/**
+ * @brief Textbook CYK over sets of nonterminals, the reference for membership in trace().
+ */
+bool referenceAccepts(const Grammar& grammar, const Word& word) {
+    size_t n = word.size();
+    if (n == 0)
+        return std::any_of(grammar.m_Rules.begin(), grammar.m_Rules.end(), [&](const auto& rule) {
+            return rule.first == grammar.m_InitialSymbol && rule.second.empty();
+        });
+    std::vector<std::vector<std::set<Symbol>>> table(n, std::vector<std::set<Symbol>>(n + 1));
+    for (size_t i = 0; i < n; ++i)
+        for (const auto& [left, right] : grammar.m_Rules)
+            if (right.size() == 1 && right[0] == word[i])
+                table[i][1].insert(left);
+    for (size_t length = 2; length <= n; ++length)
+        for (size_t start = 0; start + length <= n; ++start)
+            for (size_t split = 1; split < length; ++split)
+                for (const auto& [left, right] : grammar.m_Rules)
+                    if (right.size() == 2 && table[start][split].count(right[0]) && table[start + split][length - split].count(right[1]))
+                        table[start][length].insert(left);
+    return table[0][n].count(grammar.m_InitialSymbol) > 0;
+}
+
+/**
+ * @brief Language equivalence of two DFAs by a search of the product automaton, missing transitions lead to a sink.
+ */
+bool equivalent(const DFA& a, const DFA& b) {
+    const long sink = -1;
+    auto step = [](const DFA& dfa, long state, Symbol symbol) {
+        if (state == sink)
+            return sink;
+        auto it = dfa.m_Transitions.find({State(state), symbol});
+        return it == dfa.m_Transitions.end() ? sink : long(it->second);
+    };
+    auto isFinal = [](const DFA& dfa, long state) { return state != sink && dfa.m_FinalStates.count(state) > 0; };
+
+    std::set<Symbol> alphabet = a.m_Alphabet;
+    alphabet.insert(b.m_Alphabet.begin(), b.m_Alphabet.end());
+    std::set<std::pair<long, long>> seen{{a.m_InitialState, b.m_InitialState}};
+    std::vector<std::pair<long, long>> stack(seen.begin(), seen.end());
+    while (!stack.empty()) {
+        auto [left, right] = stack.back();
+        stack.pop_back();
+        if (isFinal(a, left) != isFinal(b, right))
+            return false;
+        for (Symbol symbol : alphabet) {
+            std::pair<long, long> next{step(a, left, symbol), step(b, right, symbol)};
+            if (seen.insert(next).second)
+                stack.push_back(next);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Checks the output contract of determinize(): transitions stay within the states and every state can reach
+ * a final one, except the single state of an empty language.
+ */
+bool isTrimmed(const DFA& dfa) {
+    if (!dfa.m_States.count(dfa.m_InitialState))
+        return false;
+    for (const auto& [from, to] : dfa.m_Transitions)
+        if (!dfa.m_States.count(from.first) || !dfa.m_States.count(to) || !dfa.m_Alphabet.count(from.second))
+            return false;
+    if (dfa.m_FinalStates.empty())
+        return dfa.m_States.size() == 1;
+    std::set<State> useful(dfa.m_FinalStates.begin(), dfa.m_FinalStates.end());
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto& [from, to] : dfa.m_Transitions)
+            if (useful.count(to) && useful.insert(from.first).second)
+                changed = true;
+    }
+    return useful == dfa.m_States;
+}
+
+MISNFA randomNFA(std::mt19937& random, size_t states, size_t symbols, double density) {
+    std::bernoulli_distribution edge(density), flag(0.25);
+    MISNFA nfa;
+    for (size_t i = 0; i < symbols; ++i)
+        nfa.m_Alphabet.insert(static_cast<Symbol>('a' + i));
+    for (State state = 0; state < states; ++state) {
+        nfa.m_States.insert(state);
+        if (flag(random))
+            nfa.m_InitialStates.insert(state);
+        if (flag(random))
+            nfa.m_FinalStates.insert(state);
+        for (Symbol symbol : nfa.m_Alphabet)
+            for (State target = 0; target < states; ++target)
+                if (edge(random))
+                    nfa.m_Transitions[{state, symbol}].insert(target);
+    }
+    if (nfa.m_InitialStates.empty())
+        nfa.m_InitialStates.insert(0);
+    return nfa;
+}
+
+/**
+ * @brief Random right-linear (or left-linear) grammar in the normal form, so the trace automaton can always be built.
+ *
+ * Terminals are 'a', 'b', ..., the states are nonterminals 'A', 'B', ... ('A' is initial) and the nonterminal
+ * 'T' + i only derives terminal i. Every state gets a terminal rule and at least one rule X -> T Y (X -> Y T when
+ * left-linear), which reads a terminal and continues in state Y.
+ */
+Grammar randomRegularGrammar(std::mt19937& random, size_t states, size_t symbols, double density, bool leftLinear) {
+    std::bernoulli_distribution edge(density);
+    std::uniform_int_distribution<size_t> pickState(0, states - 1), pickSymbol(0, symbols - 1);
+    Grammar grammar{{}, {}, {}, 'A'};
+    auto state = [](size_t index) { return static_cast<Symbol>('A' + index); };
+    auto reader = [](size_t symbol) { return static_cast<Symbol>('T' + symbol); };
+    for (size_t symbol = 0; symbol < symbols; ++symbol) {
+        grammar.m_Terminals.insert(static_cast<Symbol>('a' + symbol));
+        grammar.m_Nonterminals.insert(reader(symbol));
+        grammar.m_Rules.push_back({reader(symbol), {static_cast<Symbol>('a' + symbol)}});
+    }
+    auto addStep = [&](size_t from, size_t symbol, size_t to) {
+        if (leftLinear)
+            grammar.m_Rules.push_back({state(from), {state(to), reader(symbol)}});
+        else
+            grammar.m_Rules.push_back({state(from), {reader(symbol), state(to)}});
+    };
+    for (size_t from = 0; from < states; ++from) {
+        grammar.m_Nonterminals.insert(state(from));
+        grammar.m_Rules.push_back({state(from), {static_cast<Symbol>('a' + pickSymbol(random))}});
+        addStep(from, pickSymbol(random), pickState(random));
+        for (size_t symbol = 0; symbol < symbols; ++symbol)
+            for (size_t to = 0; to < states; ++to)
+                if (edge(random))
+                    addStep(from, symbol, to);
+    }
+    return grammar;
+}
+
+/**
+ * @brief Random word of the given (non-zero) length generated by a grammar of randomRegularGrammar().
+ */
+Word randomRegularMember(std::mt19937& random, const Grammar& grammar, size_t length, bool leftLinear) {
+    std::map<Symbol, std::vector<const std::vector<Symbol>*>> steps, ends;
+    for (const auto& [nonTerminal, ruleRightSide] : grammar.m_Rules)
+        (ruleRightSide.size() == 2 ? steps : ends)[nonTerminal].push_back(&ruleRightSide);
+    auto pick = [&](const std::vector<const std::vector<Symbol>*>& rules) {
+        return *rules[std::uniform_int_distribution<size_t>(0, rules.size() - 1)(random)];
+    };
+    Word word; // in the order of generation, backwards for a left-linear grammar
+    Symbol current = grammar.m_InitialSymbol;
+    for (size_t i = 1; i < length; ++i) {
+        const auto& step = pick(steps[current]);
+        Symbol reader = leftLinear ? step[1] : step[0];
+        word.push_back(ends[reader].front()->at(0));
+        current = leftLinear ? step[0] : step[1];
+    }
+    word.push_back(pick(ends[current])[0]);
+    if (leftLinear)
+        std::reverse(word.begin(), word.end());
+    return word;
+}
+
+/**
+ * @brief Differential checks of the optimized engines against the references, failures are printed with the seed
+ * and the iteration which reproduce them.
+ */
+class Fuzzer {
+public:
+    Fuzzer(unsigned seed)
+        : m_Seed(seed), m_Random(seed) {}
+
+    void automata(size_t iteration) {
+        MISNFA nfa = randomNFA(m_Random, 1 + iteration % 9, 1 + iteration % 3, 0.1 + 0.05 * (iteration % 5));
+        DFA dfa = determinize(nfa);
+        DFA reference = referenceDeterminize(nfa);
+        check(isTrimmed(dfa), "determinize() output is not trimmed", iteration);
+        check(equivalent(dfa, reference), "determinize() differs from the reference", iteration);
+        check(determinizeFlat(nfa).toDFA() == dfa, "determinizeFlat() differs from determinize()", iteration);
+        check(equivalent(determinize(reduceNFA(nfa).m_NFA), reference), "reduceNFA() changed the language", iteration);
+    }
+
+    void grammars(size_t iteration) {
+        Grammar grammar = randomGrammar(m_Random, {3 + iteration % 5, 2, 0.1 + 0.05 * (iteration % 4), 1});
+        std::vector<Word> words{{}};
+        for (size_t length = 1; length <= 12; ++length) {
+            if (auto member = randomMember(m_Random, grammar, length))
+                words.push_back(*member);
+            words.push_back(randomWord(m_Random, grammar, length));
+        }
+        if (iteration % 3 == 0) { // new initial symbol with the rules of the old one and the empty word
+            const Symbol initial = '$';
+            for (size_t rule = 0, rules = grammar.m_Rules.size(); rule < rules; ++rule)
+                if (grammar.m_Rules[rule].first == grammar.m_InitialSymbol)
+                    grammar.m_Rules.emplace_back(initial, grammar.m_Rules[rule].second);
+            grammar.m_Rules.emplace_back(initial, std::vector<Symbol>());
+            grammar.m_Nonterminals.insert(initial);
+            grammar.m_InitialSymbol = initial;
+        }
+
+        std::vector<std::pair<std::string, Parser>> parsers;
+        parsers.emplace_back("cyk", Parser(grammar, ParserEngine::Cyk));
+        parsers.emplace_back("compact", Parser(grammar, ParserEngine::Cyk));
+        parsers.back().second.setChartMode(ChartMode::Compact);
+        parsers.emplace_back("earley", Parser(grammar, ParserEngine::Earley));
+        parsers.emplace_back("automaton", Parser(grammar, ParserEngine::Automaton));
+        parsers.emplace_back("auto", Parser(grammar));
+
+        std::vector<bool> expected;
+        for (const auto& word : words)
+            expected.push_back(referenceAccepts(grammar, word));
+        for (auto& [name, parser] : parsers) {
+            for (size_t i = 0; i < words.size(); ++i)
+                checkTrace(grammar, words[i], parser.trace(words[i]), expected[i], name, iteration);
+            auto batch = parser.traceBatch(words, 3);
+            for (size_t i = 0; i < words.size(); ++i)
+                checkTrace(grammar, words[i], batch[i], expected[i], name + " batch", iteration);
+        }
+        for (size_t i = 0; i < words.size(); ++i) {
+            ParserSession session(grammar);
+            for (Symbol symbol : words[i])
+                session.push(symbol);
+            check(session.accepts() == expected[i], "session membership differs from the reference", iteration);
+            checkTrace(grammar, words[i], session.trace(), expected[i], "session", iteration);
+            check(ParseForest::build(*compileGrammar(grammar), words[i]).accepted() == expected[i], "forest membership differs from the reference", iteration);
+        }
+    }
+
+    /**
+     * @brief Right-linear and left-linear grammars, which randomGrammar() rarely produces: Auto has to pick the trace
+     * automaton and every engine has to agree with the reference, also on words too long for the chart search.
+     */
+    void regularGrammars(size_t iteration) {
+        bool leftLinear = iteration % 2;
+        Grammar grammar = randomRegularGrammar(m_Random, 1 + iteration % 6, 1 + iteration % 3, 0.15, leftLinear);
+        std::vector<Word> words{{}};
+        for (size_t length : {1, 2, 3, 5, 8, 13, 40}) {
+            words.push_back(randomRegularMember(m_Random, grammar, length, leftLinear));
+            Word word = randomRegularMember(m_Random, grammar, length, leftLinear);
+            word[std::uniform_int_distribution<size_t>(0, length - 1)(m_Random)] = 'a';
+            words.push_back(word);
+        }
+
+        Parser automaton(grammar, ParserEngine::Automaton), cyk(grammar, ParserEngine::Cyk);
+        check(automaton.engine() == ParserEngine::Automaton, "no trace automaton for a regular grammar", iteration);
+        check(Parser(grammar).engine() == ParserEngine::Automaton, "Auto does not pick the automaton for a regular grammar", iteration);
+        for (const auto& word : words) {
+            bool expected = referenceAccepts(grammar, word);
+            checkTrace(grammar, word, automaton.trace(word), expected, leftLinear ? "left-linear automaton" : "automaton", iteration);
+            checkTrace(grammar, word, cyk.trace(word), expected, "cyk", iteration);
+            check(automaton.accepts(word) == expected, "automaton recognition differs from the reference", iteration);
+        }
+        Word longWord = randomRegularMember(m_Random, grammar, 3000, leftLinear);
+        checkTrace(grammar, longWord, automaton.trace(longWord), true, "automaton on a long word", iteration);
+    }
+
+    size_t failures() const {
+        return m_Failures;
+    }
+
+private:
+    void check(bool condition, const std::string& message, size_t iteration) {
+        if (condition)
+            return;
+        ++m_Failures;
+        std::cout << "FAIL " << message << " (seed " << m_Seed << ", iteration " << iteration << ")" << std::endl;
+    }
+
+    void checkTrace(const Grammar& grammar, const Word& word, const std::vector<size_t>& trace, bool expected, const std::string& engine, size_t iteration) {
+        check(trace.empty() == !expected, engine + " membership differs from the reference", iteration);
+        check(trace.empty() || reconstructWord(grammar, trace) == word, engine + " trace does not derive the word", iteration);
+    }
+
+    unsigned m_Seed;
+    std::mt19937 m_Random;
+    size_t m_Failures = 0;
+};
+
+/**
+ * @brief Fixed workload, run() processes m_Items items (automata or words) once. The gate compares the throughput
+ * relative to the throughput of the reference workload m_Reference, reference workloads themselves have none.
+ */
+struct Workload {
+    std::string m_Name;
+    size_t m_Items;
+    std::function<void()> m_Run;
+    std::string m_Reference;
+};
+
+/**
+ * @brief Workloads of the performance gate, built from a fixed seed so they never change between runs.
+ *
+ * The textbook implementations of this file run as reference workloads on the same inputs. They never change,
+ * so a workload's throughput relative to its reference moves with the optimized code only and mostly cancels
+ * the speed of the machine.
+ */
+std::vector<Workload> workloads() {
+    std::mt19937 random(2024);
+    std::vector<Workload> result;
+
+    auto nfas = std::make_shared<std::vector<MISNFA>>();
+    for (size_t i = 0; i < 300; ++i)
+        nfas->push_back(randomNFA(random, 12, 3, 0.12));
+    result.push_back({"reference-determinize", nfas->size(), [nfas] {
+                          for (const auto& nfa : *nfas)
+                              referenceDeterminize(nfa);
+                      }, ""});
+    result.push_back({"determinize", nfas->size(), [nfas] {
+                          for (const auto& nfa : *nfas)
+                              determinize(nfa);
+                      }, "reference-determinize"});
+    result.push_back({"reduce-nfa", nfas->size(), [nfas] {
+                          for (const auto& nfa : *nfas)
+                              reduceNFA(nfa);
+                      }, "reference-determinize"});
+
+    Grammar grammar = randomGrammar(random, {8, 2, 0.15, 1});
+    auto words = std::make_shared<std::vector<Word>>();
+    for (size_t i = 0; i < 40; ++i)
+        words->push_back(randomMember(random, grammar, 48).value_or(randomWord(random, grammar, 48)));
+    result.push_back({"reference-cyk", 4, [grammar, words] {
+                          for (size_t i = 0; i < 4; ++i)
+                              referenceAccepts(grammar, (*words)[i]);
+                      }, ""});
+    for (const auto& [name, engine, mode] : {std::make_tuple("trace-cyk", ParserEngine::Cyk, ChartMode::Backpointers),
+                                             std::make_tuple("trace-compact", ParserEngine::Cyk, ChartMode::Compact),
+                                             std::make_tuple("trace-earley", ParserEngine::Earley, ChartMode::Auto)}) {
+        auto parser = std::make_shared<Parser>(grammar, engine);
+        parser->setChartMode(mode);
+        result.push_back({name, words->size(), [parser, words] {
+                              for (const auto& word : *words)
+                                  parser->trace(word);
+                          }, "reference-cyk"});
+    }
+
+    Grammar regular{{'A', 'B', 'S', 'X'}, {'a', 'b', 'c'}, {{'S', {'A', 'X'}}, {'S', {'c'}}, {'X', {'B', 'S'}}, {'A', {'a'}}, {'B', {'b'}}}, 'S'};
+    Word long1;
+    for (size_t i = 0; i < 2000; ++i)
+        long1.insert(long1.end(), {'a', 'b'});
+    long1.push_back('c');
+    auto automaton = std::make_shared<Parser>(regular);
+    result.push_back({"trace-automaton", 100, [automaton, long1] {
+                          for (size_t i = 0; i < 100; ++i)
+                              automaton->trace(long1);
+                      }, "reference-cyk"});
+    return result;
+}
+
+/**
+ * @brief Differential fuzzing and a performance gate over both homeworks.
+ *
+ * Options: --baseline FILE (required, regression/baseline.txt in this tree), --fuzz 300 (iterations of each fuzzer),
+ * --seed 1, --threshold 0.25 (largest allowed relative drop of throughput), --repeat 5 (runs per workload), --update
+ * (store the measured throughput as the new baseline instead of comparing). The baseline holds the throughput of every
+ * workload as a multiple of its reference workload (see workloads(), the median over alternating runs of the two)
+ * rather than items per second, so it carries over between similar machines. A different compiler or CPU family
+ * still shifts the ratios, the baseline should then be refreshed by --update on the machine which runs the gate.
+ * The exit code is 1 when a check fails, a workload got slower or has no baseline (unless --update).
+ */
+int main(int argc, char** argv) {
+    size_t fuzz = 300, repeat = 5;
+    unsigned seed = 1;
+    double threshold = 0.25;
+    std::string baselinePath;
+    bool update = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--update")
+            update = true;
+        else if (i + 1 < argc && option == "--fuzz")
+            fuzz = std::stoul(argv[++i]);
+        else if (i + 1 < argc && option == "--seed")
+            seed = std::stoul(argv[++i]);
+        else if (i + 1 < argc && option == "--baseline")
+            baselinePath = argv[++i];
+        else if (i + 1 < argc && option == "--threshold")
+            threshold = std::stod(argv[++i]);
+        else if (i + 1 < argc && option == "--repeat")
+            repeat = std::max<size_t>(1, std::stoul(argv[++i]));
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+    if (baselinePath.empty()) {
+        std::cerr << "usage: " << argv[0] << " --baseline FILE [--update] [--fuzz N] [--seed N] [--threshold X] [--repeat N]" << std::endl;
+        return 1;
+    }
+
+    Fuzzer fuzzer(seed);
+    for (size_t iteration = 0; iteration < fuzz; ++iteration) {
+        fuzzer.automata(iteration);
+        fuzzer.grammars(iteration);
+        fuzzer.regularGrammars(iteration);
+    }
+    std::cout << "fuzz: " << fuzz << " iterations, " << fuzzer.failures() << " failures" << std::endl;
+
+    std::map<std::string, double> baseline;
+    std::ifstream baselineFile(baselinePath);
+    if (!baselineFile && !update) {
+        std::cout << "cannot read the baseline " << baselinePath << ", create it with --update" << std::endl;
+        return 1;
+    }
+    std::string name;
+    for (double throughput; baselineFile >> name >> throughput;)
+        baseline[name] = throughput;
+
+    bool regressed = false;
+    std::ostringstream measured;
+    std::vector<Workload> all = workloads();
+    std::map<std::string, const Workload*> byName;
+    for (const auto& workload : all)
+        byName[workload.m_Name] = &workload;
+    auto seconds = [](const Workload& workload) {
+        auto start = std::chrono::steady_clock::now();
+        workload.m_Run();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    for (const auto& workload : all) {
+        // the reference runs right before every run of the workload and the ratio is the median of the pairs,
+        // so a machine which slows down or speeds up during the gate shifts both sides and a burst of noise
+        // disturbs only some of the pairs
+        const Workload* reference = workload.m_Reference.empty() ? nullptr : byName.at(workload.m_Reference);
+        double best = INFINITY;
+        std::vector<double> ratios;
+        for (size_t run = 0; run < repeat; ++run) {
+            double referenceSeconds = reference ? seconds(*reference) : 0;
+            double workloadSeconds = seconds(workload);
+            best = std::min(best, workloadSeconds);
+            if (reference)
+                ratios.push_back(workload.m_Items / workloadSeconds / (reference->m_Items / referenceSeconds));
+        }
+        double throughput = workload.m_Items / best;
+        std::cout << workload.m_Name << ": " << throughput << " items/s";
+        if (!reference) {
+            std::cout << std::endl;
+            continue;
+        }
+        std::nth_element(ratios.begin(), ratios.begin() + ratios.size() / 2, ratios.end());
+        double relative = ratios[ratios.size() / 2];
+        measured << workload.m_Name << " " << relative << "\n";
+        std::cout << ", " << std::fixed << std::setprecision(2) << relative << "x " << workload.m_Reference << std::defaultfloat << std::setprecision(6);
+
+        auto it = baseline.find(workload.m_Name);
+        if (update)
+            std::cout << std::endl;
+        else if (it == baseline.end()) {
+            std::cout << " NO BASELINE" << std::endl;
+            regressed = true;
+        }
+        else {
+            double ratio = relative / it->second;
+            std::cout << ", " << std::fixed << std::setprecision(2) << ratio << "x of the baseline" << std::defaultfloat << std::setprecision(6);
+            if (ratio < 1 - threshold) {
+                std::cout << " REGRESSION";
+                regressed = true;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    if (update) {
+        std::ofstream(baselinePath) << measured.str();
+        std::cout << "baseline written to " << baselinePath << std::endl;
+    }
+    return fuzzer.failures() || regressed ? 1 : 0;
+}
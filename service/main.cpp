@@ -0,0 +1,637 @@
+#include "../solutions.h"
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+/**
+ * @brief Line protocol of the service.
+ *
+ * Every request is one line and gets exactly one response line, responses come in the order of the requests.
+ * Symbols are written as themselves, except for space, backslash and non-printable bytes, which are written as \xHH.
+ *
+ *     GRAMMAR <initial> <rule>...           rules A>BC, A>a or S> (in the order of their indices)
+ *     NFA <alphabet> <initial> <final> <transition>...
+ *     DFA <alphabet> <initial> <final> <transition>...
+ *                                           state lists like 0,2 or - when empty, transitions 0:a:1,2
+ *         -> OK <id>                        id is the content hash of the definition (the next free value when
+ *                                           two definitions collide), equal definitions share it
+ *     TRACE <grammar id> <word>             -> ACCEPT <rule>... | REJECT
+ *     ACCEPTS <id> <word>                   -> ACCEPT | REJECT, for grammars and automata
+ *                                           a word whose chart would exceed the chart limit gives ERROR
+ *     DETERMINIZE <nfa id>                  -> OK <dfa id> <alphabet> <initial> <final> <transition>...
+ *     PING                                  -> OK
+ *
+ * Anything wrong with a request gives ERROR <message>. The word is the rest of the line after one space.
+ */
+namespace protocol {
+
+std::string escape(Symbol symbol) {
+    unsigned char byte = static_cast<unsigned char>(symbol);
+    if (byte > ' ' && byte < 127 && byte != '\\')
+        return std::string(1, symbol);
+    static const char* digits = "0123456789abcdef";
+    return std::string("\\x") + digits[byte >> 4] + digits[byte & 15];
+}
+
+std::string escape(const std::string& symbols) {
+    std::string result;
+    for (Symbol symbol : symbols)
+        result += escape(symbol);
+    return result;
+}
+
+/**
+ * @brief Reads one (possibly escaped) symbol of the text at the position and moves past it.
+ */
+Symbol readSymbol(const std::string& text, size_t& position) {
+    if (position >= text.size())
+        throw std::invalid_argument("missing symbol");
+    if (text[position] != '\\')
+        return text[position++];
+    if (position + 4 > text.size() || text[position + 1] != 'x' || !isxdigit(text[position + 2]) || !isxdigit(text[position + 3]))
+        throw std::invalid_argument("bad escape in '" + text + "'");
+    Symbol symbol = static_cast<Symbol>(std::stoi(text.substr(position + 2, 2), nullptr, 16));
+    position += 4;
+    return symbol;
+}
+
+std::vector<Symbol> readSymbols(const std::string& text) {
+    std::vector<Symbol> symbols;
+    for (size_t position = 0; position < text.size();)
+        symbols.push_back(readSymbol(text, position));
+    return symbols;
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> items;
+    std::istringstream stream(text);
+    for (std::string item; std::getline(stream, item, separator);)
+        items.push_back(item);
+    return items;
+}
+
+State readState(const std::string& text) {
+    if (text.empty() || !std::all_of(text.begin(), text.end(), ::isdigit))
+        throw std::invalid_argument("bad state '" + text + "'");
+    return static_cast<State>(std::stoul(text));
+}
+
+std::set<State> readStates(const std::string& text) {
+    std::set<State> states;
+    if (text != "-")
+        for (const auto& item : split(text, ','))
+            states.insert(readState(item));
+    return states;
+}
+
+std::string writeStates(const std::set<State>& states) {
+    if (states.empty())
+        return "-";
+    std::string result;
+    for (State state : states)
+        result += (result.empty() ? "" : ",") + std::to_string(state);
+    return result;
+}
+
+/**
+ * @brief Transition token from:symbol:to1,to2 split into its parts.
+ */
+std::tuple<State, Symbol, std::set<State>> readTransition(const std::string& text) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos)
+        throw std::invalid_argument("bad transition '" + text + "'");
+    size_t position = colon + 1;
+    Symbol symbol = readSymbol(text, position);
+    if (position >= text.size() || text[position] != ':')
+        throw std::invalid_argument("bad transition '" + text + "'");
+    std::set<State> targets = readStates(text.substr(position + 1));
+    if (targets.empty())
+        throw std::invalid_argument("transition without targets '" + text + "'");
+    return {readState(text.substr(0, colon)), symbol, targets};
+}
+
+/**
+ * @brief Grammar from the tokens of a GRAMMAR definition, checked to be in the normal form the parsers assume:
+ * every rule derives two nonterminals, one terminal or (only for the initial symbol, which then appears on no
+ * right side) nothing, no symbol is both a terminal and a nonterminal and no rule is repeated.
+ */
+Grammar readGrammar(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 2)
+        throw std::invalid_argument("missing initial symbol");
+    size_t position = 0;
+    Grammar grammar{{}, {}, {}, readSymbol(tokens[1], position)};
+    grammar.m_Nonterminals.insert(grammar.m_InitialSymbol);
+    for (size_t i = 2; i < tokens.size(); ++i) {
+        position = 0;
+        Symbol left = readSymbol(tokens[i], position);
+        if (position >= tokens[i].size() || tokens[i][position] != '>')
+            throw std::invalid_argument("bad rule '" + tokens[i] + "'");
+        std::vector<Symbol> right = readSymbols(tokens[i].substr(position + 1));
+        if (right.size() > 2 || (right.empty() && left != grammar.m_InitialSymbol))
+            throw std::invalid_argument("rule not in the normal form '" + tokens[i] + "'");
+        grammar.m_Nonterminals.insert(left);
+        if (right.size() == 2)
+            grammar.m_Nonterminals.insert(right.begin(), right.end());
+        else if (right.size() == 1)
+            grammar.m_Terminals.insert(right[0]);
+        grammar.m_Rules.emplace_back(left, right);
+    }
+    for (Symbol terminal : grammar.m_Terminals)
+        if (grammar.m_Nonterminals.count(terminal))
+            throw std::invalid_argument("symbol " + escape(terminal) + " is both a terminal and a nonterminal");
+    std::set<std::pair<Symbol, std::vector<Symbol>>> rules;
+    bool epsilon = false, initialOnRight = false;
+    for (const auto& rule : grammar.m_Rules) {
+        if (!rules.insert(rule).second)
+            throw std::invalid_argument("repeated rule of " + escape(rule.first));
+        epsilon = epsilon || rule.second.empty();
+        initialOnRight = initialOnRight || (rule.second.size() == 2 && std::count(rule.second.begin(), rule.second.end(), grammar.m_InitialSymbol));
+    }
+    if (epsilon && initialOnRight)
+        throw std::invalid_argument("initial symbol with an empty rule appears on a right side");
+    return grammar;
+}
+
+/**
+ * @brief Automaton from the tokens of an NFA or DFA definition, a DFA is checked to have one initial state
+ * and at most one target per transition.
+ */
+MISNFA readAutomaton(const std::vector<std::string>& tokens, bool deterministic) {
+    if (tokens.size() < 4)
+        throw std::invalid_argument("missing alphabet, initial or final states");
+    MISNFA nfa;
+    for (Symbol symbol : readSymbols(tokens[1]))
+        nfa.m_Alphabet.insert(symbol);
+    nfa.m_InitialStates = readStates(tokens[2]);
+    nfa.m_FinalStates = readStates(tokens[3]);
+    if (nfa.m_Alphabet.empty() || nfa.m_InitialStates.empty() || (deterministic && nfa.m_InitialStates.size() != 1))
+        throw std::invalid_argument("bad alphabet or initial states");
+    nfa.m_States.insert(nfa.m_InitialStates.begin(), nfa.m_InitialStates.end());
+    nfa.m_States.insert(nfa.m_FinalStates.begin(), nfa.m_FinalStates.end());
+    for (size_t i = 4; i < tokens.size(); ++i) {
+        auto [from, symbol, targets] = readTransition(tokens[i]);
+        if (!nfa.m_Alphabet.count(symbol) || (deterministic && targets.size() != 1))
+            throw std::invalid_argument("bad transition '" + tokens[i] + "'");
+        nfa.m_States.insert(from);
+        nfa.m_States.insert(targets.begin(), targets.end());
+        nfa.m_Transitions[{from, symbol}].insert(targets.begin(), targets.end());
+    }
+    return nfa;
+}
+
+/**
+ * @brief Body of a DFA definition (everything after "DFA ") describing the automaton.
+ */
+std::string writeAutomaton(const FlatDFA& dfa) {
+    std::string result = escape(std::string(dfa.m_Alphabet.begin(), dfa.m_Alphabet.end()));
+    std::set<State> final;
+    for (State state = 0; state < dfa.stateCount(); ++state)
+        if (dfa.isFinal(state))
+            final.insert(state);
+    result += " " + std::to_string(dfa.m_InitialState) + " " + writeStates(final);
+    for (State state = 0; state < dfa.stateCount(); ++state)
+        for (Symbol symbol : dfa.m_Alphabet)
+            if (dfa.next(state, symbol) != FlatDFA::NO_STATE)
+                result += " " + std::to_string(state) + ":" + escape(symbol) + ":" + std::to_string(dfa.next(state, symbol));
+    return result;
+}
+
+/**
+ * @brief 64-bit FNV-1a hash, the ids of the definitions.
+ */
+uint64_t contentHash(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char byte : text) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string writeId(uint64_t id) {
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << id;
+    return out.str();
+}
+
+} // namespace protocol
+
+/**
+ * @brief Long running service which answers protocol requests (see the protocol namespace) read from a stream.
+ *
+ * Definitions are handled by the reading thread in the order they arrive, so every later request can refer to
+ * them, and they are cached by their normalized text: a grammar is compiled and its TraceAutomaton built once
+ * and both are shared by per-worker Parsers, automata are determinized once (lazily for NFAs). The cache keeps
+ * the cacheLimit most recently used definitions, an evicted id is answered with an error until it is defined again.
+ * Every Parser keeps its CYK chart under chartLimit bytes (switching to the compact chart first), a word that
+ * does not fit even so is answered with an error instead of taking the memory of the whole service.
+ * Other requests go to a pool of workers. At most maxInFlight requests may be queued or waiting for their turn
+ * in the output, then the reader stops reading, which pushes back on the client through the pipe.
+ * The output is flushed whenever no further response is ready, so a pipelining client gets large writes
+ * and an interactive one gets every response immediately.
+ */
+class Service {
+public:
+    Service(size_t threadCount = 0, size_t maxInFlight = 1024, size_t chartLimit = size_t(256) << 20, size_t cacheLimit = 4096)
+        : m_ThreadCount(threadCount ? threadCount : std::max<size_t>(1, std::thread::hardware_concurrency())),
+          m_MaxInFlight(std::max<size_t>(1, maxInFlight)), m_ChartLimit(chartLimit), m_CacheLimit(std::max<size_t>(1, cacheLimit)) {}
+
+    /**
+     * @brief Serves requests from the input until its end or a QUIT line.
+     */
+    void run(std::istream& in, std::ostream& out) {
+        m_Done = false;
+        m_Sequence = m_Written = 0;
+        in.tie(nullptr); // a tied output would be flushed by the reading thread while the writer uses it
+        std::vector<std::thread> workers;
+        for (size_t worker = 0; worker < m_ThreadCount; ++worker)
+            workers.emplace_back([this, worker] { work(worker); });
+        std::thread writer([&] { write(out); });
+
+        for (std::string line; std::getline(in, line) && line != "QUIT";) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Room.wait(lock, [&] { return m_Sequence - m_Written < m_MaxInFlight; });
+            size_t sequence = m_Sequence++;
+            if (isDefinition(line)) {
+                lock.unlock();
+                std::string response = define(line);
+                lock.lock();
+                m_Responses.emplace(sequence, std::move(response));
+                m_Ready.notify_all();
+            }
+            else {
+                m_Jobs.push_back({sequence, std::move(line)});
+                m_Work.notify_one();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Done = true;
+        }
+        m_Work.notify_all();
+        m_Ready.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+        writer.join();
+    }
+
+    /**
+     * @return Number of cached definitions.
+     */
+    size_t cacheSize() const {
+        std::lock_guard<std::mutex> lock(m_CacheMutex);
+        return m_Recent.size();
+    }
+
+private:
+    struct Job {
+        size_t m_Sequence;
+        std::string m_Line;
+    };
+
+    /**
+     * @brief Cached definition, the automaton of an NFA is determinized on first use. A grammar has
+     * a TraceAutomaton when it is regular enough for one, see TraceAutomaton::build(), and one Parser
+     * per worker (created by the worker on first use), so evicting the entry frees them all.
+     */
+    struct Entry {
+        uint64_t m_Id = 0;
+        std::string m_Definition;
+        std::shared_ptr<const CompiledGrammar> m_Grammar;
+        std::vector<std::unique_ptr<Parser>> m_Parsers;
+        std::shared_ptr<const TraceAutomaton> m_TraceAutomaton;
+        MISNFA m_NFA;
+        std::once_flag m_Determinized;
+        std::shared_ptr<const FlatDFA> m_DFA;
+    };
+
+    static bool isDefinition(const std::string& line) {
+        return line.rfind("GRAMMAR ", 0) == 0 || line.rfind("NFA ", 0) == 0 || line.rfind("DFA ", 0) == 0;
+    }
+
+    /**
+     * @brief Parses the definition and caches it under its normalized text (tokens joined by one space).
+     */
+    std::string define(const std::string& line) {
+        std::vector<std::string> tokens;
+        std::istringstream stream(line);
+        for (std::string token; stream >> token;)
+            tokens.push_back(token);
+        std::string normalized;
+        for (const auto& token : tokens)
+            normalized += (normalized.empty() ? "" : " ") + token;
+
+        {
+            std::lock_guard<std::mutex> lock(m_CacheMutex);
+            auto it = m_ByDefinition.find(normalized);
+            if (it != m_ByDefinition.end())
+                return "OK " + protocol::writeId(touch(it->second)->m_Id);
+        }
+
+        auto entry = std::make_shared<Entry>();
+        entry->m_Definition = normalized;
+        try {
+            if (tokens[0] == "GRAMMAR") {
+                entry->m_Grammar = compileGrammar(protocol::readGrammar(tokens));
+                entry->m_TraceAutomaton = TraceAutomaton::build(*entry->m_Grammar);
+                entry->m_Parsers.resize(m_ThreadCount);
+            }
+            else
+                entry->m_NFA = protocol::readAutomaton(tokens, tokens[0] == "DFA");
+        }
+        catch (const std::exception& error) {
+            return std::string("ERROR ") + error.what();
+        }
+        std::lock_guard<std::mutex> lock(m_CacheMutex);
+        return "OK " + protocol::writeId(insert(entry)->m_Id);
+    }
+
+    /**
+     * @brief Moves the cached entry to the front of the recently used ones, the cache mutex has to be held.
+     */
+    const std::shared_ptr<Entry>& touch(std::list<std::shared_ptr<Entry>>::iterator position) {
+        m_Recent.splice(m_Recent.begin(), m_Recent, position);
+        return m_Recent.front();
+    }
+
+    /**
+     * @brief Caches a new entry (or returns the equal one another thread cached meanwhile) and evicts the least
+     * recently used ones over the limit, the cache mutex has to be held. The id is the content hash of the
+     * definition, a collision takes the next free value, so a lookup never returns a different definition.
+     */
+    const std::shared_ptr<Entry>& insert(const std::shared_ptr<Entry>& entry) {
+        auto existing = m_ByDefinition.find(entry->m_Definition);
+        if (existing != m_ByDefinition.end())
+            return touch(existing->second);
+        entry->m_Id = protocol::contentHash(entry->m_Definition);
+        while (m_ById.count(entry->m_Id))
+            ++entry->m_Id;
+        m_Recent.push_front(entry);
+        m_ById.emplace(entry->m_Id, m_Recent.begin());
+        m_ByDefinition.emplace(entry->m_Definition, m_Recent.begin());
+        while (m_Recent.size() > m_CacheLimit) {
+            m_ById.erase(m_Recent.back()->m_Id);
+            m_ByDefinition.erase(m_Recent.back()->m_Definition);
+            m_Recent.pop_back();
+        }
+        return m_Recent.front();
+    }
+
+    std::shared_ptr<Entry> find(const std::string& id) {
+        uint64_t key;
+        try {
+            size_t used;
+            key = std::stoull(id, &used, 16);
+            if (used != id.size())
+                return nullptr;
+        }
+        catch (const std::exception&) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(m_CacheMutex);
+        auto it = m_ById.find(key);
+        return it == m_ById.end() ? nullptr : touch(it->second);
+    }
+
+    static const FlatDFA& automatonOf(Entry& entry) {
+        std::call_once(entry.m_Determinized, [&] { entry.m_DFA = std::make_shared<const FlatDFA>(determinizeFlat(entry.m_NFA)); });
+        return *entry.m_DFA;
+    }
+
+    std::string handle(const std::string& line, size_t worker) {
+        size_t space = line.find(' ');
+        std::string command = line.substr(0, space);
+        if (command == "PING")
+            return "OK";
+        if (space == std::string::npos)
+            return "ERROR unknown request '" + line + "'";
+
+        size_t idEnd = line.find(' ', space + 1);
+        auto entry = find(line.substr(space + 1, idEnd == std::string::npos ? std::string::npos : idEnd - space - 1));
+        if (!entry)
+            return "ERROR unknown id";
+        try {
+            Word word;
+            if (idEnd != std::string::npos)
+                word = protocol::readSymbols(line.substr(idEnd + 1));
+
+            if (command == "TRACE" || (command == "ACCEPTS" && entry->m_Grammar)) {
+                if (!entry->m_Grammar)
+                    return "ERROR not a grammar";
+                auto& parser = entry->m_Parsers[worker];
+                if (!parser) {
+                    parser = std::make_unique<Parser>(entry->m_Grammar, entry->m_TraceAutomaton);
+                    parser->setMemoryLimit(m_ChartLimit);
+                }
+                if (command == "ACCEPTS")
+                    return parser->accepts(word) ? "ACCEPT" : "REJECT";
+                std::vector<size_t> trace = parser->trace(word);
+                if (trace.empty())
+                    return "REJECT";
+                std::string response = "ACCEPT";
+                for (size_t rule : trace)
+                    response += " " + std::to_string(rule);
+                return response;
+            }
+            if (entry->m_Grammar)
+                return "ERROR not an automaton";
+            if (command == "ACCEPTS")
+                return automatonOf(*entry).accepts(std::string(word.begin(), word.end())) ? "ACCEPT" : "REJECT";
+            if (command == "DETERMINIZE") {
+                std::string body = protocol::writeAutomaton(automatonOf(*entry));
+                std::string response = define("DFA " + body);
+                return response.rfind("OK ", 0) == 0 ? response + " " + body : response;
+            }
+        }
+        catch (const std::exception& error) {
+            return std::string("ERROR ") + error.what();
+        }
+        return "ERROR unknown request '" + command + "'";
+    }
+
+    void work(size_t worker) {
+        while (true) {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Work.wait(lock, [&] { return m_Done || !m_Jobs.empty(); });
+            if (m_Jobs.empty())
+                return;
+            Job job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+            lock.unlock();
+
+            std::string response = handle(job.m_Line, worker);
+            lock.lock();
+            m_Responses.emplace(job.m_Sequence, std::move(response));
+            m_Ready.notify_all();
+        }
+    }
+
+    void write(std::ostream& out) {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        while (true) {
+            m_Ready.wait(lock, [&] { return m_Responses.count(m_Written) || (m_Done && m_Written == m_Sequence); });
+            if (!m_Responses.count(m_Written))
+                return;
+            std::vector<std::string> batch;
+            for (auto it = m_Responses.find(m_Written); it != m_Responses.end() && it->first == m_Written; it = m_Responses.erase(it)) {
+                batch.push_back(std::move(it->second));
+                ++m_Written;
+            }
+            m_Room.notify_one();
+            lock.unlock();
+            for (const auto& response : batch)
+                out << response << '\n';
+            out.flush();
+            lock.lock();
+        }
+    }
+
+    const size_t m_ThreadCount;
+    const size_t m_MaxInFlight;
+    const size_t m_ChartLimit;
+    const size_t m_CacheLimit;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Work;
+    std::condition_variable m_Ready;
+    std::condition_variable m_Room;
+    std::deque<Job> m_Jobs;
+    std::map<size_t, std::string> m_Responses;
+    size_t m_Sequence = 0;
+    size_t m_Written = 0;
+    bool m_Done = false;
+
+    mutable std::mutex m_CacheMutex;
+    std::list<std::shared_ptr<Entry>> m_Recent; // most recently used first
+    std::unordered_map<uint64_t, std::list<std::shared_ptr<Entry>>::iterator> m_ById;
+    std::unordered_map<std::string, std::list<std::shared_ptr<Entry>>::iterator> m_ByDefinition;
+};
+
+/**
+ * @brief Runs a scripted session and returns the response lines.
+ */
+std::vector<std::string> session(Service& service, const std::vector<std::string>& requests) {
+    std::stringstream in, out;
+    for (const auto& request : requests)
+        in << request << '\n';
+    service.run(in, out);
+    std::vector<std::string> responses;
+    for (std::string line; std::getline(out, line);)
+        responses.push_back(line);
+    return responses;
+}
+
+int main(int argc, char** argv) {
+    size_t threads = 0, inFlight = 1024, chartLimit = size_t(256) << 20, cacheLimit = 4096;
+    bool test = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--test")
+            test = true;
+        else if (option == "--threads" && i + 1 < argc)
+            threads = std::stoul(argv[++i]);
+        else if (option == "--in-flight" && i + 1 < argc)
+            inFlight = std::stoul(argv[++i]);
+        else if (option == "--chart-limit" && i + 1 < argc)
+            chartLimit = std::stoull(argv[++i]);
+        else if (option == "--cache-limit" && i + 1 < argc)
+            cacheLimit = std::stoul(argv[++i]);
+        else {
+            std::cerr << "usage: " << argv[0] << " [--threads N] [--in-flight N] [--chart-limit BYTES] [--cache-limit N] [--test]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!test) {
+        std::ios::sync_with_stdio(false);
+        Service(threads, inFlight, chartLimit, cacheLimit).run(std::cin, std::cout);
+        return 0;
+    }
+
+    assert(protocol::escape(' ') == "\\x20" && protocol::escape('a') == "a" && protocol::escape('\\') == "\\x5c");
+    assert(protocol::readSymbols("a\\x20b") == Word({'a', ' ', 'b'}));
+    size_t position = 0;
+    assert(protocol::readSymbol("\\x3e>", position) == '>' && position == 4);
+    assert(std::get<2>(protocol::readTransition("3:\\x3a:1,2")) == std::set<State>({1, 2}));
+
+    Service service(4, 3);
+    std::string g = "GRAMMAR S S>AB A>a B>b A>\\x20";
+    auto responses = session(service, {
+        g,
+        "GRAMMAR  S S>AB   A>a B>b A>\\x20 ",
+        "NFA ab 0 1 0:a:0,1 0:b:0",
+        "PING",
+        "GRAMMAR S S>a a>b",
+        "GRAMMAR S A>",
+        "GRAMMAR S S> S>SS S>a",
+        "GRAMMAR S S>a S>a",
+        "NFA ab 0 1 0:c:1",
+        "HELLO",
+        "TRACE 0000000000000000 ab",
+    });
+    assert(responses.size() == 11);
+    std::string grammarId = responses[0].substr(3), nfaId = responses[2].substr(3);
+    assert(responses[0].rfind("OK ", 0) == 0 && grammarId.size() == 16 && responses[1] == responses[0]);
+    assert(responses[2].rfind("OK ", 0) == 0 && responses[3] == "OK");
+    for (size_t i = 4; i < 11; ++i)
+        assert(responses[i].rfind("ERROR ", 0) == 0);
+    assert(responses[6] == "ERROR initial symbol with an empty rule appears on a right side");
+    assert(responses[7] == "ERROR repeated rule of S");
+    assert(service.cacheSize() == 2);
+
+    std::vector<std::string> requests{"TRACE " + grammarId + " ab", "TRACE " + grammarId + " \\x20b", "TRACE " + grammarId + " ba",
+                                      "ACCEPTS " + grammarId + " ab", "TRACE " + grammarId, "DETERMINIZE " + nfaId,
+                                      "ACCEPTS " + nfaId + " bba", "ACCEPTS " + nfaId + " ab", "TRACE " + nfaId + " a"};
+    for (size_t i = 0; i < 200; ++i) //more requests than fit in flight, all answered in order
+        requests.push_back("TRACE " + grammarId + (i % 2 ? " ab" : " bb"));
+    responses = session(service, requests);
+    assert(responses.size() == requests.size());
+    assert(responses[0] == "ACCEPT 0 1 2" && responses[1] == "ACCEPT 0 3 2" && responses[2] == "REJECT");
+    assert(responses[3] == "ACCEPT" && responses[4] == "REJECT");
+    assert(responses[5].rfind("OK ", 0) == 0 && responses[5].substr(20) == "ab 0 1 0:a:1 0:b:0 1:a:1 1:b:0");
+    assert(responses[6] == "ACCEPT" && responses[7] == "REJECT" && responses[8] == "ERROR not a grammar");
+    for (size_t i = 0; i < 200; ++i)
+        assert(responses[9 + i] == (i % 2 ? "ACCEPT 0 1 2" : "REJECT"));
+
+    Service small(2, 16, size_t(256) << 20, 2); //keeps the two most recently used definitions
+    std::string a = "GRAMMAR S S>a", b = "GRAMMAR S S>b", c = "GRAMMAR S S>c";
+    std::string aId = protocol::writeId(protocol::contentHash(a)), bId = protocol::writeId(protocol::contentHash(b));
+    assert(session(small, {a, b}) == std::vector<std::string>({"OK " + aId, "OK " + bId}));
+    assert(session(small, {"TRACE " + aId + " a"}) == std::vector<std::string>({"ACCEPT 0"}));
+    session(small, {c});
+    assert(small.cacheSize() == 2);
+    assert(session(small, {"TRACE " + aId + " a", "TRACE " + bId + " b"}) == std::vector<std::string>({"ACCEPT 0", "ERROR unknown id"}));
+    assert(session(small, {b, "TRACE " + bId + " b"}) == std::vector<std::string>({"OK " + bId, "ACCEPT 0"}));
+
+    std::string dfaId = responses[5].substr(3, 16);
+    responses = session(service, {"DFA ab 0 1 0:a:1 0:b:0 1:a:1 1:b:0", "ACCEPTS " + dfaId + " ba", "DFA ab 0 1 0:a:0,1"});
+    assert(responses[0] == "OK " + dfaId && responses[1] == "ACCEPT" && responses[2].rfind("ERROR ", 0) == 0);
+
+    std::string nested = "GRAMMAR S S>AX X>SB S>AB A>a B>b", regular = "GRAMMAR S S>AX X>BS S>c A>a B>b";
+    auto nestedGrammar = compileGrammar(protocol::readGrammar(protocol::split(nested, ' ')));
+    Service limited(2, 16, Parser(nestedGrammar, ParserEngine::Cyk).chartBytes(40, ChartMode::Compact));
+    std::string longRegular;
+    for (size_t i = 0; i < 5000; ++i)
+        longRegular += "ab";
+    responses = session(limited, {nested, regular});
+    std::string nestedId = responses[0].substr(3), regularId = responses[1].substr(3);
+    responses = session(limited, {"TRACE " + nestedId + " " + std::string(20, 'a') + std::string(20, 'b'),
+                                  "ACCEPTS " + nestedId + " " + std::string(20, 'a') + std::string(20, 'b'),
+                                  "TRACE " + nestedId + " " + std::string(30, 'a') + std::string(30, 'b'),
+                                  "ACCEPTS " + nestedId + " " + std::string(30, 'a') + std::string(30, 'b'),
+                                  "ACCEPTS " + regularId + " " + longRegular + "c",
+                                  "ACCEPTS " + regularId + " " + longRegular + "b"});
+    assert(responses[0].rfind("ACCEPT 0 ", 0) == 0 && responses[1] == "ACCEPT");
+    assert(responses[2] == "ERROR CYK chart exceeds the memory limit" && responses[3] == responses[2]);
+    assert(responses[4] == "ACCEPT" && responses[5] == "REJECT");
+    std::cout << "SERVICE OK" << std::endl;
+    return 0;
+}
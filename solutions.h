@@ -0,0 +1,65 @@
+// Solutions of all homeworks in one translation unit for the tools, see service/ and regression/.
+#pragma once
+
+// the headers of the homework templates, the solutions have to include anything else themselves
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <stack>
+#include <vector>
+#ifdef TEST_HELPERS
+#include <random>
+#endif
+
+using State = unsigned int;
+using Symbol = char;
+using Word = std::vector<Symbol>;
+
+struct MISNFA {
+    std::set<State> m_States;
+    std::set<Symbol> m_Alphabet;
+    std::map<std::pair<State, Symbol>, std::set<State>> m_Transitions;
+    std::set<State> m_InitialStates;
+    std::set<State> m_FinalStates;
+};
+
+struct DFA {
+    std::set<State> m_States;
+    std::set<Symbol> m_Alphabet;
+    std::map<std::pair<State, Symbol>, State> m_Transitions;
+    State m_InitialState;
+    std::set<State> m_FinalStates;
+
+    bool operator==(const DFA& dfa)
+    {
+        return std::tie(m_States, m_Alphabet, m_Transitions, m_InitialState, m_FinalStates) == std::tie(dfa.m_States, dfa.m_Alphabet, dfa.m_Transitions, dfa.m_InitialState, dfa.m_FinalStates);
+    }
+};
+
+struct Grammar {
+    std::set<Symbol> m_Nonterminals;
+    std::set<Symbol> m_Terminals;
+    std::vector<std::pair<Symbol, std::vector<Symbol>>> m_Rules;
+    Symbol m_InitialSymbol;
+};
+
+// Both solutions compiled as they are submitted, the structures above play the role of the testing environment.
+#define __PROGTEST__
+#include "hw01/main.cpp"
+#include "hw02/main.cpp"
@@ -0,0 +1,19 @@
+#!/bin/bash
+# Builds the homeworks and the tools and runs their tests, the same binaries as the submissions and the gate.
+# hw02 is built twice, the second build with PARSER_STATS compiles and tests the instrumentation of the parser.
+set -e
+cd "$(dirname "$0")"
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -o "$out/hw01" hw01/main.cpp
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -o "$out/hw02" hw02/main.cpp
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -DPARSER_STATS -o "$out/hw02-stats" hw02/main.cpp
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -o "$out/service" service/main.cpp
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -o "$out/regression" regression/main.cpp
+
+"$out/hw01"
+"$out/hw02"
+"$out/hw02-stats"
+"$out/service" --test
+"$out/regression" --baseline regression/baseline.txt "$@"